@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include "arena.h"
+#include "logging.h"
+
+struct arena_chunk {
+  struct arena_chunk *prev;
+  size_t size, used;
+};
+
+// Os dados começam logo após o cabeçalho, arredondado para ARENA_ALIGN
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_DATA(chunk) ((unsigned char *)(chunk) + ARENA_ROUND(sizeof(struct arena_chunk)))
+
+static struct arena_chunk *
+arena_chunk_create(size_t size, struct arena_chunk *prev)
+{
+  struct arena_chunk *ans = malloc(ARENA_ROUND(sizeof(*ans)) + size);
+  if (!ans)
+    REPORT_AND_EXIT;
+  ans->prev = prev;
+  ans->size = size;
+  ans->used = 0;
+  return ans;
+}
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+  size = ARENA_ROUND(size);
+  struct arena_chunk *chunk = arena->head;
+  if ((chunk == NULL) || (chunk->size - chunk->used < size)) {
+    if (size > ARENA_CHUNK_SIZE / 4) {
+      // grande demais, dá um bloco próprio e mantém o atual como cabeça
+      chunk = arena_chunk_create(size, chunk);
+      if (arena->head != NULL) {
+        chunk->prev = arena->head->prev;
+        arena->head->prev = chunk;
+      } else {
+        arena->head = chunk;
+      }
+      chunk->used = size;
+      return ARENA_DATA(chunk);
+    }
+    chunk = arena_chunk_create(ARENA_CHUNK_SIZE, chunk);
+    arena->head = chunk;
+  }
+  void *ans = ARENA_DATA(chunk) + chunk->used;
+  chunk->used += size;
+  return ans;
+}
+
+void
+arena_free(struct arena *arena)
+{
+  struct arena_chunk *chunk = arena->head;
+  while (chunk != NULL) {
+    struct arena_chunk *prev = chunk->prev;
+    free(chunk);
+    chunk = prev;
+  }
+  arena->head = NULL;
+}
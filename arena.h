@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Alocador "bump pointer": aloca sequencialmente de blocos grandes e libera
+ * tudo de uma vez. Serve para objetos que vivem até o fim da compilação
+ * (símbolos, nodos), evitando um malloc/free por objeto.
+ */
+
+// Tamanho padrão de cada bloco. Alocações maiores ganham um bloco próprio.
+#define ARENA_CHUNK_SIZE (64 * 1024)
+// Alinhamento de toda alocação, suficiente para qualquer tipo escalar
+#define ARENA_ALIGN 16
+
+struct arena_chunk;
+
+struct arena {
+  struct arena_chunk *head;
+};
+
+/*
+ * Retorna size bytes alinhados a ARENA_ALIGN, não inicializados. Aborta se
+ * não houver memória.
+ */
+void *
+arena_alloc(struct arena *arena, size_t size);
+
+/*
+ * Libera todos os blocos da arena, que pode ser reutilizada depois.
+ */
+void
+arena_free(struct arena *arena);
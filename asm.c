@@ -4,14 +4,74 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdbool.h>
 #include "logging.h"
 #include "asm.h"
 #include "tac.h"
 #include "hash.h"
 #include "dry.h"
+#include "regalloc.h"
+#include "ast.h"
 
 #define VP "ufrgs_var_" // VAR PREFIX
+#define TP "ufrgs_tmp_" // temporary (dummy) PREFIX
 #define VL ".ufrgs_label_" // label PREFIX
+#define NP "ufrgs_neg_" // negative constant PREFIX, '-' can't be in a name
+#define ASM_NAME_BUFS 4 // names usable in a single fprintf, see asm_name
+
+// Program being printed and the instruction name of each of its operands,
+// indexed by operand id (see asm_print_names)
+static const struct tac_prog *PROG = NULL;
+static char **VARS = NULL;
+// Whether each operand is still referenced by some instruction, and how many
+// times each is read
+static bool *USED = NULL;
+static size_t *NUSES = NULL;
+// Register of each operand, and where each operand's value is: a register or
+// its global (see asm_oploc)
+static struct regalloc RA = { NULL, NULL, NULL, NULL, 0 };
+static char **LOCS = NULL;
+// Index of the function being printed, for RA.saved and RA.calls
+static size_t FUNC = 0;
+// For each instruction, the vector whose address an enclosing loop keeps in
+// %rcx, 0 if none (see asm_vec_bases)
+static uint32_t *VECBASE = NULL;
+// Operands each function keeps in memory, LOCALS[LOCALSTART[f], LOCALSTART[f + 1])
+static size_t *LOCALSTART = NULL;
+static uint32_t *LOCALS = NULL;
+
+/*
+ * Frame of the function being printed. Functions that call others get a
+ * %rbp frame: saved registers, then 4-byte slots, with %rsp 16-byte aligned.
+ * Leaf functions push only the saved registers and keep their slots in the
+ * red zone below %rsp.
+ */
+static struct {
+  struct hash_node *func;
+  bool leaf;
+  bool tail;     // has a self tail call, which jumps to after the prologue
+  size_t nsaved; // callee-saved registers pushed
+  size_t size;   // bytes subtracted from %rsp after the pushes
+} FRAME;
+
+// Arguments of the call being set up (see asm_print_call)
+static const struct tac_insn **ARGS = NULL;
+static size_t NARGS = 0,
+              ARGCAP = 0;
+
+// Bytes of red zone below %rsp a leaf function may use
+#define ASM_RED_ZONE 128
+// Integer argument registers, in order, and how many there are
+#define ASM_NARGREGS 6
+static const char * const ARGREGS32[ASM_NARGREGS] = { "%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d" };
+
+// Registers handed out by regalloc, callee-saved first (see RA_NCALLEE)
+static const char * const REGS32[RA_NREGS] = {
+  "%ebx", "%r12d", "%r13d", "%r14d", "%r15d", "%esi", "%edi", "%r8d", "%r9d", "%r10d", "%r11d"
+};
+static const char * const REGS64[RA_NREGS] = {
+  "%rbx", "%r12", "%r13", "%r14", "%r15", "%rsi", "%rdi", "%r8", "%r9", "%r10", "%r11"
+};
 
 static long int
 asm_strtol(char * const str)
@@ -28,48 +88,505 @@ asm_strtol(char * const str)
   return ans;
 }
 
+/*
+ * Returns the name of a variable: prefix + key for symbols, or the temporary
+ * (label) prefix + id for dummies (labels), which have no key. The string
+ * lives in one of ASM_NAME_BUFS rotating buffers, so it is only valid for a
+ * few calls.
+ */
+static const char *
+asm_name(struct hash_node *hnode, const char *prefix, const char *tprefix, const char *lprefix)
+{
+  static char *bufs[ASM_NAME_BUFS] = { NULL };
+  static size_t sizes[ASM_NAME_BUFS] = { 0 };
+  static size_t next = 0;
+  size_t i = next++ % ASM_NAME_BUFS,
+         need = strlen(prefix) + hnode->len + 32;
+  if (sizes[i] < need) {
+    bufs[i] = realloc(bufs[i], need);
+    if (!bufs[i])
+      REPORT_AND_EXIT;
+    sizes[i] = need;
+  }
+  if (hnode->typeinfo.nature == hn_tmp_t)
+    snprintf(bufs[i], need, "%s%zu", tprefix, hnode->id);
+  else if (hnode->typeinfo.nature == hn_label_t)
+    snprintf(bufs[i], need, "%s%zu", lprefix, hnode->id);
+  else if ((hnode->typeinfo.nature == hn_int_t) && (hnode->key[0] == '-') && (prefix[0] != '\0'))
+    snprintf(bufs[i], need, "%s%s", NP, hnode->key + 1);
+  else
+    snprintf(bufs[i], need, "%s%s", prefix, hnode->key);
+  return bufs[i];
+}
+
+// Symbol as used in instructions (ufrgs_var_a, ufrgs_tmp_3, .ufrgs_label_2)
+static const char *
+asm_var(struct hash_node *hnode)
+{
+  return asm_name(hnode, VP, TP, VL);
+}
+
+// Symbol as shown in debug comments (a, dummy3, label2)
+static const char *
+asm_key(struct hash_node *hnode)
+{
+  return asm_name(hnode, "", "dummy", "label");
+}
+
+// Operand of the program being printed
+static struct hash_node *
+asm_op(uint32_t id)
+{
+  return PROG->ops[id];
+}
+
+// Instruction name of an operand, precomputed by asm_print_names
+static const char *
+asm_opvar(uint32_t id)
+{
+  return VARS[id];
+}
+
+static const char *
+asm_opkey(uint32_t id)
+{
+  return asm_key(asm_op(id));
+}
+
+// Value of an operand as an instruction operand: "%reg", "$imm" or "name(%rip)"
+static const char *
+asm_oploc(uint32_t id)
+{
+  return LOCS[id];
+}
+
+static bool
+asm_is_reg(uint32_t id)
+{
+  return RA.reg[id] != RA_NONE;
+}
+
+// Whether both operands live in the same register
+static bool
+asm_same_reg(uint32_t a, uint32_t b)
+{
+  return asm_is_reg(a) && (RA.reg[a] == RA.reg[b]);
+}
+
+// Whether a location string is in memory (not a register or immediate)
+static bool
+asm_is_mem_loc(const char *loc)
+{
+  return (loc[0] != '%') && (loc[0] != '$');
+}
+
+// Whether the operand is a literal, emitted as an immediate
+static bool
+asm_is_imm(uint32_t id)
+{
+  return asm_oploc(id)[0] == '$';
+}
+
+/*
+ * Names each operand once, instead of formatting its key on every use, and
+ * finds which ones the optimizations left referenced
+ */
 static void
-asm_print_cmp(FILE *out, enum ttype_t ttype)
+asm_print_names(void)
+{
+  VARS = calloc(PROG->nops, sizeof(*VARS));
+  LOCS = calloc(PROG->nops, sizeof(*LOCS));
+  USED = calloc(PROG->nops, sizeof(*USED));
+  NUSES = calloc(PROG->nops, sizeof(*NUSES));
+  if (!VARS || !LOCS || !USED || !NUSES)
+    REPORT_AND_EXIT;
+  for (size_t i = 0; i < PROG->ninsns; i++) {
+    struct tac_insn insn = PROG->insns[i];
+    USED[insn.ans] = USED[insn.op1] = USED[insn.op2] = true;
+    uint32_t *uses[TAC_MAX_USES];
+    unsigned int n = tac_insn_uses(&insn, uses);
+    for (unsigned int u = 0; u < n; u++)
+      NUSES[*uses[u]]++;
+  }
+  for (size_t i = 1; i < PROG->nops; i++) {
+    VARS[i] = strdup(asm_var(PROG->ops[i]));
+    if (!VARS[i])
+      REPORT_AND_EXIT;
+    int32_t val = 0;
+    if (RA.reg[i] != RA_NONE) {
+      LOCS[i] = strdup(REGS32[RA.reg[i]]);
+    } else if (tac_prog_const_value(PROG, (uint32_t)i, &val)) {
+      LOCS[i] = malloc(sizeof("$-2147483648"));
+      if (LOCS[i])
+        sprintf(LOCS[i], "$%d", val);
+    } else {
+      LOCS[i] = malloc(strlen(VARS[i]) + sizeof("(%rip)"));
+      if (LOCS[i])
+        sprintf(LOCS[i], "%s(%%rip)", VARS[i]);
+    }
+    if (!LOCS[i])
+      REPORT_AND_EXIT;
+  }
+}
+
+static void
+asm_free_names(void)
+{
+  for (size_t i = 1; i < PROG->nops; i++) {
+    free(VARS[i]);
+    free(LOCS[i]);
+  }
+  free(VARS);
+  free(LOCS);
+  free(USED);
+  free(NUSES);
+  VARS = NULL;
+  LOCS = NULL;
+  USED = NULL;
+  NUSES = NULL;
+}
+
+// Symbols that were never operands (or no longer are) need no storage
+static bool
+asm_is_used(struct hash_node *hnode)
+{
+  return (hnode->opid != 0) && USED[hnode->opid];
+}
+
+// Condition code suffix (as in setCC, jCC) for a comparison, or for its
+// negation
+static const char *
+asm_cc(enum ttype_t ttype, bool negate)
 {
-  fprintf(out, "cmpl %%edx, %%eax\n");
   switch (ttype) {
     case t_lt_t:
-      fprintf(out, "setl %%al\n");
-      break;
+      return negate ? "ge" : "l";
     case t_gt_t:
-      fprintf(out, "setg %%al\n");
-      break;
+      return negate ? "le" : "g";
     case t_ge_t:
-      fprintf(out, "setge %%al\n");
-      break;
+      return negate ? "l" : "ge";
     case t_le_t:
-      fprintf(out, "setle %%al\n");
-      break;
+      return negate ? "g" : "le";
     case t_eq_t:
-      fprintf(out, "sete %%al\n");
-      break;
+      return negate ? "ne" : "e";
     case t_ne_t:
-      fprintf(out, "setne %%al\n");
-      break;
+      return negate ? "e" : "ne";
     default:
       LOG_AND_EXIT("Not a comparison: %d", ttype);
   }
+}
+
+static bool
+asm_is_cmp(enum ttype_t ttype)
+{
+  return (ttype == t_lt_t) || (ttype == t_gt_t) || (ttype == t_le_t) || (ttype == t_ge_t) || (ttype == t_eq_t) ||
+         (ttype == t_ne_t);
+}
+
+// Sets the flags comparing op1 to op2, straight from op1's register if it has
+// one
+static void
+asm_print_cmpl(FILE *out, uint32_t op1, uint32_t op2)
+{
+  if (asm_is_reg(op1) || (!asm_is_imm(op1) && !asm_is_mem_loc(asm_oploc(op2)))) {
+    fprintf(out, "cmpl %s, %s\n", asm_oploc(op2), asm_oploc(op1));
+  } else {
+    fprintf(out, "movl %s, %%eax\n", asm_oploc(op1));
+    fprintf(out, "cmpl %s, %%eax\n", asm_oploc(op2));
+  }
+}
+
+// Leaves the comparison result (0 or 1) in %eax
+static void
+asm_print_cmp(FILE *out, const struct tac_insn *insn)
+{
+  asm_print_cmpl(out, insn->op1, insn->op2);
+  fprintf(out, "set%s %%al\n", asm_cc(insn->ttype, false));
   fprintf(out, "movzbl %%al, %%eax\n");
 }
 
+/*
+ * Two-operand arithmetic (op is addl, subl, imull). When the result has a
+ * register, compute in place instead of going through %eax, as long as that
+ * does not overwrite op2 before reading it.
+ */
 static void
-asm_print_expr(FILE *out, struct tac_node *thead)
+asm_print_arith(FILE *out, const struct tac_insn *insn, const char *op, bool commutative)
 {
-  tac_validate_ops(thead, 3, __func__, __LINE__);
-  char *ans = thead->ans->key,
-       *op1 = thead->op1->key,
-       *op2 = thead->op2->key;
-  enum ttype_t ttype = thead->ttype;
+  uint32_t ans = insn->ans,
+           op1 = insn->op1,
+           op2 = insn->op2;
+  if (asm_is_reg(ans) && asm_same_reg(ans, op2) && commutative) {
+    op2 = op1;
+    op1 = ans;
+  }
+  if (asm_is_reg(ans) && !asm_same_reg(ans, op2)) {
+    if (!asm_same_reg(ans, op1))
+      fprintf(out, "movl %s, %s\n", asm_oploc(op1), asm_oploc(ans));
+    fprintf(out, "%s %s, %s\n", op, asm_oploc(op2), asm_oploc(ans));
+  } else {
+    fprintf(out, "movl %s, %%eax\n", asm_oploc(op1));
+    fprintf(out, "%s %s, %%eax\n", op, asm_oploc(op2));
+    fprintf(out, "movl %%eax, %s\n", asm_oploc(ans));
+  }
+}
+
+/*
+ * A comparison whose result is only read by the jmpf right after it: compare
+ * and jump on the inverted condition, without materializing the boolean
+ */
+static bool
+asm_is_cmp_jmpf(const struct tac_insn *insn, const struct tac_insn *next)
+{
+  return asm_is_cmp(insn->ttype) && (next->ttype == t_jmpf_t) && (next->op1 == insn->ans) &&
+         (NUSES[insn->ans] == 1) && (asm_op(insn->ans)->typeinfo.nature == hn_tmp_t);
+}
+
+static void
+asm_print_cmp_jmpf(FILE *out, const struct tac_insn *insn, const struct tac_insn *next)
+{
+  tac_validate_ops(insn, 3, __func__, __LINE__);
+  tac_validate_ops(next, 2, __func__, __LINE__);
+  if (LOG_LEVEL == LOG_LEVEL_DEBUG)
+    fprintf(out, "#jmpf %s, %s %s %s\n", asm_opkey(next->ans), asm_opkey(insn->op1), asm_cc(insn->ttype, false),
+            asm_opkey(insn->op2));
+  asm_print_cmpl(out, insn->op1, insn->op2);
+  fprintf(out, "j%s %s\n", asm_cc(insn->ttype, true), asm_opvar(next->ans));
+}
+
+/*
+ * x = x - 1 followed by a test of x against zero that only the next jmpf
+ * reads (the count-down of a counted loop): subl already sets ZF, so jump on
+ * it without a cmpl
+ */
+static bool
+asm_is_dec_jmpf(const struct tac_insn *insn)
+{
+  const struct tac_insn *cmp = insn + 1;
+  int32_t one = 0,
+          zero = 1;
+  return (insn->ttype == t_sub_t) && (insn->ans == insn->op1) && tac_prog_const_value(PROG, insn->op2, &one) &&
+         (one == 1) && ((cmp->ttype == t_eq_t) || (cmp->ttype == t_ne_t)) && (cmp->op1 == insn->ans) &&
+         tac_prog_const_value(PROG, cmp->op2, &zero) && (zero == 0) && asm_is_cmp_jmpf(cmp, cmp + 1);
+}
+
+static void
+asm_print_dec_jmpf(FILE *out, const struct tac_insn *insn)
+{
+  const struct tac_insn *cmp = insn + 1,
+                        *next = insn + 2;
+  tac_validate_ops(insn, 3, __func__, __LINE__);
+  tac_validate_ops(next, 2, __func__, __LINE__);
+  if (LOG_LEVEL == LOG_LEVEL_DEBUG)
+    fprintf(out, "#jmpf %s, --%s %s 0\n", asm_opkey(next->ans), asm_opkey(insn->ans), asm_cc(cmp->ttype, false));
+  fprintf(out, "subl $1, %s\n", asm_oploc(insn->ans));
+  fprintf(out, "j%s %s\n", asm_cc(cmp->ttype, true), asm_opvar(next->ans));
+}
+
+// Whether the constant c is a power of two, and which
+static bool
+asm_is_pow2(uint32_t c, int *k)
+{
+  if ((c == 0) || (c & (c - 1)))
+    return false;
+  for (*k = 0; !(c & 1); c >>= 1)
+    (*k)++;
+  return true;
+}
+
+/*
+ * ans = x * c without imull where possible: c = ±2^k * m, m in {1, 3, 5, 9},
+ * is a leal (x,x,m-1) for m, a shll for 2^k and a negl for the sign. Other
+ * constants use the immediate form of imull. Returns whether the result was
+ * left in %eax.
+ */
+static bool
+asm_print_mul_const(FILE *out, const struct tac_insn *insn, uint32_t x, int32_t c)
+{
+  bool in_eax = !asm_is_reg(insn->ans);
+  const char *dst = in_eax ? "%eax" : asm_oploc(insn->ans),
+             *dst64 = in_eax ? "%rax" : REGS64[RA.reg[insn->ans]];
+  uint32_t mag = (c < 0) ? -(uint32_t)c : (uint32_t)c,
+           m = mag;
+  int k = 0;
+  while ((m != 0) && !(m & 1)) {
+    m >>= 1;
+    k++;
+  }
+
+  if (c == 0) {
+    fprintf(out, "movl $0, %s\n", dst);
+    return in_eax;
+  }
+  if ((c == INT32_MIN) || ((m != 1) && (m != 3) && (m != 5) && (m != 9))) {
+    fprintf(out, "imull $%d, %s, %s\n", c, asm_oploc(x), dst);
+    return in_eax;
+  }
+
+  if ((m > 1) && asm_is_reg(x)) {
+    fprintf(out, "leal (%s,%s,%u), %s\n", REGS64[RA.reg[x]], REGS64[RA.reg[x]], m - 1, dst);
+  } else {
+    if (in_eax || !asm_same_reg(insn->ans, x))
+      fprintf(out, "movl %s, %s\n", asm_oploc(x), dst);
+    if (m > 1)
+      fprintf(out, "leal (%s,%s,%u), %s\n", dst64, dst64, m - 1, dst);
+  }
+  if (k > 0)
+    fprintf(out, "shll $%d, %s\n", k, dst);
+  if (c < 0)
+    fprintf(out, "negl %s\n", dst);
+  return in_eax;
+}
+
+/*
+ * Magic number and shift for signed division by d (|d| >= 2): the quotient
+ * is the high half of M * n, corrected by n and shifted by s, plus one if
+ * negative. Hacker's Delight, 10-1.
+ */
+static void
+asm_div_magic(int32_t d, int32_t *magic, int *shift)
+{
+  const uint32_t two31 = 0x80000000u;
+  uint32_t ad = (d < 0) ? -(uint32_t)d : (uint32_t)d,
+           t = two31 + ((uint32_t)d >> 31),
+           anc = t - 1 - t % ad,
+           q1 = two31 / anc,
+           r1 = two31 - q1 * anc,
+           q2 = two31 / ad,
+           r2 = two31 - q2 * ad,
+           delta = 0;
+  int p = 31;
+  do {
+    p++;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc) {
+      q1++;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= ad) {
+      q2++;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while ((q1 < delta) || ((q1 == delta) && (r1 == 0)));
+  uint32_t m = q2 + 1;
+  *magic = (int32_t)((d < 0) ? -m : m);
+  *shift = p - 32;
+}
+
+/*
+ * %eax = x / d, truncating, without idivl: powers of two shift with a bias
+ * of 2^k - 1 for negative dividends, other divisors multiply by a magic
+ * reciprocal. 0, -1 and INT32_MIN keep idivl (and its trap on overflow or
+ * division by zero); returns false for them.
+ */
+static bool
+asm_print_div_const(FILE *out, uint32_t x, int32_t d)
+{
+  if ((d == 0) || (d == -1) || (d == INT32_MIN))
+    return false;
+
+  uint32_t mag = (d < 0) ? -(uint32_t)d : (uint32_t)d;
+  int k = 0;
+  if (asm_is_pow2(mag, &k)) {
+    fprintf(out, "movl %s, %%eax\n", asm_oploc(x));
+    if (k > 0) {
+      fprintf(out, "movl %%eax, %%edx\n");
+      if (k > 1)
+        fprintf(out, "sarl $31, %%edx\n");
+      fprintf(out, "shrl $%d, %%edx\n", 32 - k);
+      fprintf(out, "addl %%edx, %%eax\n");
+      fprintf(out, "sarl $%d, %%eax\n", k);
+    }
+    if (d < 0)
+      fprintf(out, "negl %%eax\n");
+    return true;
+  }
+
+  int32_t magic = 0;
+  int shift = 0;
+  asm_div_magic(d, &magic, &shift);
+  fprintf(out, "movl %s, %%ecx\n", asm_oploc(x));
+  fprintf(out, "movl $%d, %%eax\n", magic);
+  fprintf(out, "imull %%ecx\n");
+  if ((d > 0) && (magic < 0))
+    fprintf(out, "addl %%ecx, %%edx\n");
+  else if ((d < 0) && (magic > 0))
+    fprintf(out, "subl %%ecx, %%edx\n");
+  if (shift > 0)
+    fprintf(out, "sarl $%d, %%edx\n", shift);
+  fprintf(out, "movl %%edx, %%eax\n");
+  fprintf(out, "shrl $31, %%eax\n");
+  fprintf(out, "addl %%edx, %%eax\n");
+  return true;
+}
+
+/*
+ * ans = op1 ^ op2, with the exponent taken as unsigned (see opt_pow). A
+ * constant exponent becomes a chain of squarings and multiplications by the
+ * base, from the highest bit down (x^2 is a single imull); otherwise an
+ * O(log exponent) square-and-multiply loop on %eax, %ecx and %edx. Returns
+ * whether the result was left in %eax.
+ */
+static bool
+asm_print_pow(FILE *out, const struct tac_insn *insn)
+{
+  static int pow_labels = 0;
+  int32_t exp = 0;
+
+  if (tac_prog_const_value(PROG, insn->op2, &exp)) {
+    uint32_t bits = (uint32_t)exp;
+    if (bits == 0) {
+      fprintf(out, "movl $1, %%eax\n");
+      return true;
+    }
+    // The base is read again, so it can't be overwritten
+    bool in_eax = !asm_is_reg(insn->ans) || asm_same_reg(insn->ans, insn->op1);
+    const char *dst = in_eax ? "%eax" : asm_oploc(insn->ans);
+    fprintf(out, "movl %s, %s\n", asm_oploc(insn->op1), dst);
+    int top = 31;
+    while (!(bits & (1u << top)))
+      top--;
+    for (int b = top - 1; b >= 0; b--) {
+      fprintf(out, "imull %s, %s\n", dst, dst);
+      if (bits & (1u << b))
+        fprintf(out, "imull %s, %s\n", asm_oploc(insn->op1), dst);
+    }
+    return in_eax;
+  }
+
+  int label = pow_labels++;
+  fprintf(out, "movl %s, %%ecx\n", asm_oploc(insn->op1));
+  fprintf(out, "movl %s, %%edx\n", asm_oploc(insn->op2));
+  fprintf(out, "movl $1, %%eax\n");
+  fprintf(out, "testl %%edx, %%edx\n");
+  fprintf(out, "je .ufrgs_pow_end%d\n", label);
+  fprintf(out, ".ufrgs_pow%d:\n", label);
+  fprintf(out, "testl $1, %%edx\n");
+  fprintf(out, "je .ufrgs_pow_sq%d\n", label);
+  fprintf(out, "imull %%ecx, %%eax\n");
+  fprintf(out, ".ufrgs_pow_sq%d:\n", label);
+  fprintf(out, "imull %%ecx, %%ecx\n");
+  fprintf(out, "shrl %%edx\n");
+  fprintf(out, "jne .ufrgs_pow%d\n", label);
+  fprintf(out, ".ufrgs_pow_end%d:\n", label);
+  return true;
+}
+
+static void
+asm_print_expr(FILE *out, const struct tac_insn *insn)
+{
+  tac_validate_ops(insn, 3, __func__, __LINE__);
+  enum ttype_t ttype = insn->ttype;
   if (LOG_LEVEL == LOG_LEVEL_DEBUG)
     fprintf(out, "#EXPR_START\n");
   static int or_labels = 0;
-  fprintf(out, "movl "VP"%s(%%rip), %%eax\n", op1);
-  fprintf(out, "movl "VP"%s(%%rip), %%edx\n", op2);
+  // Whether the result is left in %eax, to be stored
+  bool in_eax = true;
+  int32_t c = 0;
   switch (ttype) {
     case t_lt_t:
     case t_le_t:
@@ -77,27 +594,43 @@ asm_print_expr(FILE *out, struct tac_node *thead)
     case t_ge_t:
     case t_eq_t:
     case t_ne_t:
-      asm_print_cmp(out, ttype);
+      asm_print_cmp(out, insn);
       break;
     case t_add_t:
-      fprintf(out, "addl %%edx, %%eax\n");
+      asm_print_arith(out, insn, "addl", true);
+      in_eax = false;
       break;
     case t_sub_t:
-      fprintf(out, "subl %%edx, %%eax\n");
+      asm_print_arith(out, insn, "subl", false);
+      in_eax = false;
       break;
     case t_mul_t:
-      fprintf(out, "imull %%edx, %%eax\n");
+      if (tac_prog_const_value(PROG, insn->op2, &c)) {
+        in_eax = asm_print_mul_const(out, insn, insn->op1, c);
+      } else if (tac_prog_const_value(PROG, insn->op1, &c)) {
+        in_eax = asm_print_mul_const(out, insn, insn->op2, c);
+      } else {
+        asm_print_arith(out, insn, "imull", true);
+        in_eax = false;
+      }
       break;
     case t_div_t:
+      if (tac_prog_const_value(PROG, insn->op2, &c) && asm_print_div_const(out, insn->op1, c))
+        break;
       // stackoverflow.com/questions/39658992
-      fprintf(out, "movl %%eax, %%ebx\n");
-      fprintf(out, "movl %%edx, %%ecx\n");
+      fprintf(out, "movl %s, %%eax\n", asm_oploc(insn->op1));
+      fprintf(out, "movl %s, %%ecx\n", asm_oploc(insn->op2));
       fprintf(out, "cdq\n");
       fprintf(out, "idivl %%ecx\n");
       break;
+    case t_pow_t:
+      in_eax = asm_print_pow(out, insn);
+      break;
     case t_or_t:
       if (LOG_LEVEL == LOG_LEVEL_DEBUG)
-        fprintf(out, "#%s := %s or %s\n", ans, op1, op2);
+        fprintf(out, "#%s := %s or %s\n", asm_opkey(insn->ans), asm_opkey(insn->op1), asm_opkey(insn->op2));
+      fprintf(out, "movl %s, %%eax\n", asm_oploc(insn->op1));
+      fprintf(out, "movl %s, %%edx\n", asm_oploc(insn->op2));
       fprintf(out, "testl %%eax, %%eax\n");
       fprintf(out, "jne .true%d\n", or_labels++);
       fprintf(out, "testl %%edx, %%edx\n");
@@ -111,15 +644,21 @@ asm_print_expr(FILE *out, struct tac_node *thead)
       break;
     case t_and_t:
       if (LOG_LEVEL == LOG_LEVEL_DEBUG)
-        fprintf(out, "#%s := %s and %s\n", ans, op1, op2);
-      fprintf(out, "cmpl %%eax, %%edx\n");
-      fprintf(out, "sete %%al\n");
+        fprintf(out, "#%s := %s and %s\n", asm_opkey(insn->ans), asm_opkey(insn->op1), asm_opkey(insn->op2));
+      fprintf(out, "movl %s, %%eax\n", asm_oploc(insn->op1));
+      fprintf(out, "movl %s, %%edx\n", asm_oploc(insn->op2));
+      fprintf(out, "testl %%eax, %%eax\n");
+      fprintf(out, "setne %%al\n");
+      fprintf(out, "testl %%edx, %%edx\n");
+      fprintf(out, "setne %%dl\n");
+      fprintf(out, "andb %%dl, %%al\n");
       fprintf(out, "movzbl %%al, %%eax\n");
       break;
     default:
       LOG_AND_EXIT("Not an expression: %d\n", ttype);
   }
-  fprintf(out, "movl %%eax, "VP"%s(%%rip)\n", ans);
+  if (in_eax)
+    fprintf(out, "movl %%eax, %s\n", asm_oploc(insn->ans));
   if (LOG_LEVEL == LOG_LEVEL_DEBUG)
     fprintf(out, "#EXPR_END\n");
 }
@@ -146,93 +685,360 @@ asm_get_str_sanitized(char * const str)
   return realloc(ans, strlen(ans) + 1);
 }
 
-static char *
-asm_get_argname(struct ast_node *anode, int argc)
+static void
+asm_print_label(FILE *out, const struct tac_insn *insn)
 {
-  if (anode == NULL)
-    LOG_AND_EXIT("Argc mismatch\n");
-  // The arglist is backwards, go to the last arg then count back argc
-  struct ast_node *argv[MAX_ARGC];
-  int i = 0;
-  do {
-    argv[i] = anode;
-    anode = anode->children[1];
-    i++;
-  } while ((anode != NULL) && (i < MAX_ARGC));
-  if (i >= MAX_ARGC)
-    LOG_AND_EXIT("Max argc of %d exceeded\n", MAX_ARGC);
-  if (argc >= i)
-    LOG_AND_EXIT("Argc mismatch %d:%d\n", argc, i);
-  anode = argv[i - (argc + 1)];
-  ast_validate_children(anode, 1, __func__, __LINE__);
-  ast_validate_symbol(anode->children[0], 1, __func__, __LINE__);
-  return anode->children[0]->children[0]->symbol->key;
+  tac_validate_ops(insn, 1, __func__, __LINE__);
+  size_t i = (size_t)(insn - PROG->insns);
+  if ((VECBASE[i] != 0) && ((i == 0) || (VECBASE[i - 1] != VECBASE[i])))
+    fprintf(out, "leaq %s(%%rip), %%rcx\n", asm_opvar(VECBASE[i]));
+  fprintf(out, "%s:\n", asm_opvar(insn->ans));
+}
+
+// Whether a vector access uses a literal index, folded into the displacement
+static bool
+asm_is_lit_index(uint32_t index)
+{
+  return asm_op(index)->typeinfo.nature == hn_int_t;
+}
+
+/*
+ * Loops (a label and the last jump back to it) that index a single vector
+ * at runtime, can only be entered through that label and don't touch %rcx
+ * get the vector's address loaded into %rcx once, before the label (see
+ * asm_print_label), instead of on every access. Outer loops are tried first.
+ */
+static void
+asm_vec_bases(void)
+{
+  size_t n = PROG->ninsns,
+         *first = malloc(PROG->nops * sizeof(*first)),
+         *last = calloc(PROG->nops, sizeof(*last));
+  VECBASE = calloc(n ? n : 1, sizeof(*VECBASE));
+  if (!first || !last || !VECBASE)
+    REPORT_AND_EXIT;
+  for (size_t id = 0; id < PROG->nops; id++)
+    first[id] = SIZE_MAX;
+  for (size_t i = 0; i < n; i++) {
+    const struct tac_insn *insn = &PROG->insns[i];
+    if ((insn->ttype != t_jmp_t) && (insn->ttype != t_jmpf_t))
+      continue;
+    if (first[insn->ans] == SIZE_MAX)
+      first[insn->ans] = i;
+    last[insn->ans] = i;
+  }
+
+  for (size_t h = 0; h < n; h++) {
+    const struct tac_insn *head = &PROG->insns[h];
+    if ((head->ttype != t_label_t) || (VECBASE[h] != 0) || (first[head->ans] < h) || (last[head->ans] <= h))
+      continue;
+    size_t e = last[head->ans];
+    uint32_t vec = 0;
+    bool ok = true;
+    for (size_t i = h; (i <= e) && ok; i++) {
+      const struct tac_insn *insn = &PROG->insns[i];
+      switch (insn->ttype) {
+        case t_call_t:
+        case t_arg_t:
+        case t_print_t:
+        case t_read_t:
+        case t_div_t:
+        case t_pow_t:
+          ok = false; // use %ecx
+          break;
+        case t_label_t:
+          ok = (first[insn->ans] == SIZE_MAX) || ((first[insn->ans] >= h) && (last[insn->ans] <= e));
+          break;
+        case t_vread_t:
+          if (!asm_is_lit_index(insn->op2)) {
+            ok = (vec == 0) || (vec == insn->op1);
+            vec = insn->op1;
+          }
+          break;
+        case t_vcopy_t:
+          if (!asm_is_lit_index(insn->op1)) {
+            ok = (vec == 0) || (vec == insn->ans);
+            vec = insn->ans;
+          }
+          break;
+        default:
+          break;
+      }
+    }
+    if (ok && (vec != 0)) {
+      for (size_t i = h; i <= e; i++)
+        VECBASE[i] = vec;
+    }
+  }
+
+  free(first);
+  free(last);
 }
 
+/*
+ * Address of vec[index] for a runtime index, as (%rcx,%rax,4)
+ */
 static void
-asm_print_label(FILE *out, struct tac_node *thead)
+asm_print_vaddr(FILE *out, const struct tac_insn *insn, uint32_t vec, uint32_t index)
 {
-  tac_validate_ops(thead, 1, __func__, __LINE__);
-  fprintf(out, VL"%s:\n", thead->ans->key);
+  fprintf(out, "movslq %s, %%rax\n", asm_oploc(index));
+  if (VECBASE[insn - PROG->insns] != vec)
+    fprintf(out, "leaq %s(%%rip), %%rcx\n", asm_opvar(vec));
 }
 
 static void
-asm_print_vread(FILE *out, struct tac_node *thead)
+asm_print_vread(FILE *out, const struct tac_insn *insn)
 {
   // 0 - dummy
   // 1 - id
   // 2 - index
-  tac_validate_ops(thead, 3, __func__, __LINE__);
+  tac_validate_ops(insn, 3, __func__, __LINE__);
   if (LOG_LEVEL == LOG_LEVEL_DEBUG)
-    fprintf(out, "#%s := %s[%s]\n", thead->ans->key, thead->op1->key, thead->op2->key);
-  long int index = asm_strtol(thead->op2->key);
-  fprintf(out, "movl %ld+"VP"%s(%%rip), %%eax\n", index * 4, thead->op1->key); // TODO sizes based on type
-  fprintf(out, "movl %%eax, "VP"%s(%%rip)\n", thead->ans->key);
+    fprintf(out, "#%s := %s[%s]\n", asm_opkey(insn->ans), asm_opkey(insn->op1), asm_opkey(insn->op2));
+  if (!asm_is_lit_index(insn->op2)) {
+    asm_print_vaddr(out, insn, insn->op1, insn->op2);
+    if (asm_is_reg(insn->ans)) {
+      fprintf(out, "movl (%%rcx,%%rax,4), %s\n", asm_oploc(insn->ans)); // TODO sizes based on type
+    } else {
+      fprintf(out, "movl (%%rcx,%%rax,4), %%eax\n");
+      fprintf(out, "movl %%eax, %s\n", asm_oploc(insn->ans));
+    }
+    return;
+  }
+  long int index = asm_strtol(asm_op(insn->op2)->key);
+  fprintf(out, "movl %ld+%s(%%rip), %%eax\n", index * 4, asm_opvar(insn->op1)); // TODO sizes based on type
+  fprintf(out, "movl %%eax, %s\n", asm_oploc(insn->ans));
 }
 
 static void
-asm_print_vcopy(FILE *out, struct tac_node *thead)
+asm_print_vcopy(FILE *out, const struct tac_insn *insn)
 {
   // 0 - id
   // 1 - index
   // 2 - value
-  tac_validate_ops(thead, 3, __func__, __LINE__);
+  tac_validate_ops(insn, 3, __func__, __LINE__);
   if (LOG_LEVEL == LOG_LEVEL_DEBUG)
-    fprintf(out, "#%s[%s] := %s\n", thead->ans->key, thead->op1->key, thead->op2->key);
-  long int index = asm_strtol(thead->op1->key);
-  fprintf(out, "movl "VP"%s(%%rip), %%eax\n", thead->op2->key);
-  fprintf(out, "movl %%eax, %ld+"VP"%s(%%rip)\n", index * 4, thead->ans->key); // TODO sizes based on type
+    fprintf(out, "#%s[%s] := %s\n", asm_opkey(insn->ans), asm_opkey(insn->op1), asm_opkey(insn->op2));
+  if (!asm_is_lit_index(insn->op1)) {
+    asm_print_vaddr(out, insn, insn->ans, insn->op1);
+    if (asm_is_mem_loc(asm_oploc(insn->op2))) {
+      fprintf(out, "movl %s, %%edx\n", asm_oploc(insn->op2));
+      fprintf(out, "movl %%edx, (%%rcx,%%rax,4)\n"); // TODO sizes based on type
+    } else {
+      fprintf(out, "movl %s, (%%rcx,%%rax,4)\n", asm_oploc(insn->op2));
+    }
+    return;
+  }
+  long int index = asm_strtol(asm_op(insn->op1)->key);
+  fprintf(out, "movl %s, %%eax\n", asm_oploc(insn->op2));
+  fprintf(out, "movl %%eax, %ld+%s(%%rip)\n", index * 4, asm_opvar(insn->ans)); // TODO sizes based on type
 }
 
 static void
-asm_print_jmpf(FILE *out, struct tac_node *thead)
+asm_print_jmpf(FILE *out, const struct tac_insn *insn)
 {
-  tac_validate_ops(thead, 2, __func__, __LINE__);
+  tac_validate_ops(insn, 2, __func__, __LINE__);
   if (LOG_LEVEL == LOG_LEVEL_DEBUG)
-    fprintf(out, "#jmpf %s, %s\n", thead->ans->key, thead->op1->key);
-  fprintf(out, "movl "VP"%s(%%rip), %%eax\n", thead->op1->key);
-  fprintf(out, "testl %%eax, %%eax\n");
-  fprintf(out, "je "VL"%s\n", thead->ans->key);
+    fprintf(out, "#jmpf %s, %s\n", asm_opkey(insn->ans), asm_opkey(insn->op1));
+  int32_t val = 0;
+  if (tac_prog_const_value(PROG, insn->op1, &val)) {
+    // Usually folded already
+    if (val == 0)
+      fprintf(out, "jmp %s\n", asm_opvar(insn->ans));
+    return;
+  }
+  fprintf(out, "cmpl $0, %s\n", asm_oploc(insn->op1));
+  fprintf(out, "je %s\n", asm_opvar(insn->ans));
 }
 
 static void
-asm_print_jmp(FILE *out, struct tac_node *thead)
+asm_print_jmp(FILE *out, const struct tac_insn *insn)
 {
-  tac_validate_ops(thead, 1, __func__, __LINE__);
+  tac_validate_ops(insn, 1, __func__, __LINE__);
   if (LOG_LEVEL == LOG_LEVEL_DEBUG)
-    fprintf(out, "#jmp %s\n", thead->ans->key);
-  fprintf(out, "jmp "VL"%s\n", thead->ans->key);
+    fprintf(out, "#jmp %s\n", asm_opkey(insn->ans));
+  fprintf(out, "jmp %s\n", asm_opvar(insn->ans));
+}
+
+/*
+ * Call whose result is returned right away. A self call assigns the arguments
+ * to the parameters and jumps back to after the prologue; a call to another
+ * function puts the arguments in registers, tears the frame down and jumps,
+ * so the callee returns straight to our caller. Calls that would pass
+ * arguments on the stack are not tail calls, since our caller's argument area
+ * may be too small for them.
+ */
+static bool
+asm_is_tail_call(const struct tac_insn *insn, const struct tac_insn *next)
+{
+  return (insn->ttype == t_call_t) && (next->ttype == t_ret_t) && (insn->ans != 0) &&
+         (next->ans == insn->ans) && (NUSES[insn->ans] == 1) &&
+         ((asm_op(insn->op1) == FRAME.func) || (ast_func_param(asm_op(insn->op1), ASM_NARGREGS) == NULL));
+}
+
+// Points LOCS[id] at a frame location
+static void
+asm_set_loc(uint32_t id, const char *fmt, long int offset)
+{
+  free(LOCS[id]);
+  LOCS[id] = malloc(32);
+  if (!LOCS[id])
+    REPORT_AND_EXIT;
+  snprintf(LOCS[id], 32, fmt, offset);
 }
 
+/*
+ * Parallel assignment: each moves[i][0] gets the old value of moves[i][1].
+ * A move is emitted once no pending move still reads its destination, and
+ * cycles are broken through %eax. Memory to memory moves go through %ecx.
+ */
 static void
-asm_print_fstart(FILE *out, struct tac_node *thead)
+asm_print_moves(FILE *out, const char *(*moves)[2], size_t n)
 {
-  tac_validate_ops(thead, 1, __func__, __LINE__);
+  bool *done = calloc(n ? n : 1, sizeof(*done));
+  if (!done)
+    REPORT_AND_EXIT;
+  size_t left = 0;
+  for (size_t i = 0; i < n; i++) {
+    done[i] = (strcmp(moves[i][0], moves[i][1]) == 0);
+    left += !done[i];
+  }
+
+  while (left > 0) {
+    bool progress = false;
+    for (size_t i = 0; i < n; i++) {
+      if (done[i])
+        continue;
+      bool read = false;
+      for (size_t j = 0; (j < n) && !read; j++)
+        read = !done[j] && (j != i) && (strcmp(moves[j][1], moves[i][0]) == 0);
+      if (!read) {
+        if (asm_is_mem_loc(moves[i][0]) && asm_is_mem_loc(moves[i][1])) {
+          fprintf(out, "movl %s, %%ecx\n", moves[i][1]);
+          fprintf(out, "movl %%ecx, %s\n", moves[i][0]);
+        } else {
+          fprintf(out, "movl %s, %s\n", moves[i][1], moves[i][0]);
+        }
+        done[i] = true;
+        left--;
+        progress = true;
+      }
+    }
+    if (progress)
+      continue;
+    // Only cycles left: save one destination and read it from %eax instead
+    size_t i = 0;
+    while (done[i])
+      i++;
+    fprintf(out, "movl %s, %%eax\n", moves[i][0]);
+    for (size_t j = 0; j < n; j++) {
+      if (!done[j] && (strcmp(moves[j][1], moves[i][0]) == 0))
+        moves[j][1] = "%eax";
+    }
+  }
+
+  free(done);
+}
+
+static void
+asm_print_fstart(FILE *out, const struct tac_insn *insn)
+{
+  tac_validate_ops(insn, 1, __func__, __LINE__);
+  struct hash_node *func = asm_op(insn->ans),
+                   *param = NULL;
+  size_t nslots = LOCALSTART[FUNC + 1] - LOCALSTART[FUNC];
+
+  // Parameters without a register also need a slot, unless they came on the
+  // stack
+  for (size_t k = 0; (k < ASM_NARGREGS) && ((param = ast_func_param(func, k)) != NULL); k++)
+    nslots += (param->opid != 0) && !asm_is_reg(param->opid);
+
+  FRAME.func = func;
+  FRAME.tail = false;
+  for (const struct tac_insn *i = insn + 1; (i->ttype != t_fend_t) && !FRAME.tail; i++)
+    FRAME.tail = asm_is_tail_call(i, i + 1) && (asm_op(i->op1) == func);
+  FRAME.leaf = !RA.calls[FUNC] && (4 * nslots <= ASM_RED_ZONE);
+  FRAME.nsaved = 0;
+  for (int r = 0; r < RA_NCALLEE; r++)
+    FRAME.nsaved += (RA.saved[FUNC] >> r) & 1;
+  FRAME.size = 0;
+  if (!FRAME.leaf)
+    FRAME.size = (8 * FRAME.nsaved + 4 * nslots + 15) / 16 * 16 - 8 * FRAME.nsaved;
+
   if (LOG_LEVEL == LOG_LEVEL_DEBUG)
-    fprintf(out, "#Function start\n");
-  fprintf(out, "%s:\n", thead->ans->key);
-  fprintf(out, "pushq %%rbp\n");
-  fprintf(out, "movq %%rsp, %%rbp\n");
+    fprintf(out, "#Function start%s\n", FRAME.leaf ? " (leaf)" : "");
+  fprintf(out, "%s:\n", func->key);
+  if (!FRAME.leaf) {
+    fprintf(out, "pushq %%rbp\n");
+    fprintf(out, "movq %%rsp, %%rbp\n");
+  }
+  for (int r = 0; r < RA_NCALLEE; r++) {
+    if (RA.saved[FUNC] & (1u << r))
+      fprintf(out, "pushq %s\n", REGS64[r]);
+  }
+  if (FRAME.size > 0)
+    fprintf(out, "subq $%zu, %%rsp\n", FRAME.size);
+
+  // Slots below the saved registers (or below %rsp, in the red zone)
+  const char *slotfmt = FRAME.leaf ? "%ld(%%rsp)" : "%ld(%%rbp)";
+  long int slot = FRAME.leaf ? 0 : -8 * (long int)FRAME.nsaved;
+  for (size_t l = LOCALSTART[FUNC]; l < LOCALSTART[FUNC + 1]; l++) {
+    slot -= 4;
+    asm_set_loc(LOCALS[l], slotfmt, slot);
+  }
+
+  // Parameters go from the argument registers (or the caller's stack) to
+  // their registers or slots, all at once since they may overlap
+  const char *(*moves)[2] = NULL;
+  char (*incoming)[32] = NULL;
+  size_t nmoves = 0;
+  for (size_t k = 0; (param = ast_func_param(func, k)) != NULL; k++) {
+    uint32_t id = param->opid;
+    if (id == 0)
+      continue; // never used
+    moves = realloc(moves, (nmoves + 1) * sizeof(*moves));
+    incoming = realloc(incoming, (nmoves + 1) * sizeof(*incoming));
+    if (!moves || !incoming)
+      REPORT_AND_EXIT;
+    if (k >= ASM_NARGREGS) {
+      // Above the return address (and %rbp, or the saved registers)
+      long int offset = 8 * (long int)(k - ASM_NARGREGS) + (FRAME.leaf ? 8 + 8 * (long int)FRAME.nsaved : 16);
+      if (!asm_is_reg(id)) {
+        asm_set_loc(id, FRAME.leaf ? "%ld(%%rsp)" : "%ld(%%rbp)", offset);
+        continue;
+      }
+      snprintf(incoming[nmoves], sizeof(*incoming), FRAME.leaf ? "%ld(%%rsp)" : "%ld(%%rbp)", offset);
+    } else {
+      if (!asm_is_reg(id)) {
+        slot -= 4;
+        asm_set_loc(id, slotfmt, slot);
+      }
+      snprintf(incoming[nmoves], sizeof(*incoming), "%s", ARGREGS32[k]);
+    }
+    moves[nmoves][0] = asm_oploc(id);
+    nmoves++;
+  }
+  for (size_t m = 0; m < nmoves; m++)
+    moves[m][1] = incoming[m];
+  asm_print_moves(out, moves, nmoves);
+  free(moves);
+  free(incoming);
+  if (FRAME.tail)
+    fprintf(out, ".ufrgs_tail_%s:\n", func->key);
+}
+
+// Restores %rsp and the saved registers, up to the ret
+static void
+asm_print_teardown(FILE *out)
+{
+  if (FRAME.size > 0)
+    fprintf(out, "addq $%zu, %%rsp\n", FRAME.size);
+  for (int r = RA_NCALLEE; r-- > 0;) {
+    if (RA.saved[FUNC] & (1u << r))
+      fprintf(out, "popq %s\n", REGS64[r]);
+  }
+  if (!FRAME.leaf)
+    fprintf(out, "popq %%rbp\n");
 }
 
 static void
@@ -240,42 +1046,46 @@ asm_print_fend(FILE *out)
 {
   if (LOG_LEVEL == LOG_LEVEL_DEBUG)
     fprintf(out, "#Function end\n");
-  fprintf(out, "popq %%rbp\n");
+  asm_print_teardown(out);
   fprintf(out, "ret\n");
 }
-
 static void
-asm_print_copy(FILE *out, struct tac_node *thead)
+asm_print_copy(FILE *out, const struct tac_insn *insn)
 {
-  tac_validate_ops(thead, 2, __func__, __LINE__);
+  tac_validate_ops(insn, 2, __func__, __LINE__);
   if (LOG_LEVEL == LOG_LEVEL_DEBUG)
-    fprintf(out, "#%s := %s\n", thead->ans->key, thead->op1->key);
-  fprintf(out, "movl "VP"%s(%%rip), %%eax\n", thead->op1->key);
-  fprintf(out, "movl %%eax, "VP"%s(%%rip)\n", thead->ans->key);
+    fprintf(out, "#%s := %s\n", asm_opkey(insn->ans), asm_opkey(insn->op1));
+  if (asm_same_reg(insn->ans, insn->op1))
+    return;
+  if (!asm_is_mem_loc(asm_oploc(insn->ans)) || !asm_is_mem_loc(asm_oploc(insn->op1))) {
+    fprintf(out, "movl %s, %s\n", asm_oploc(insn->op1), asm_oploc(insn->ans));
+  } else {
+    fprintf(out, "movl %s, %%eax\n", asm_oploc(insn->op1));
+    fprintf(out, "movl %%eax, %s\n", asm_oploc(insn->ans));
+  }
 }
 
 static void
-asm_print_print(FILE *out, struct tac_node *thead)
+asm_print_print(FILE *out, const struct tac_insn *insn)
 {
-  tac_validate_ops(thead, 1, __func__, __LINE__);
+  tac_validate_ops(insn, 1, __func__, __LINE__);
   char *copy = NULL,
        *sanitized = NULL;
 
   if (LOG_LEVEL == LOG_LEVEL_DEBUG)
-    fprintf(out, "#Print %s\n", thead->ans->key);
+    fprintf(out, "#Print %s\n", asm_opkey(insn->ans));
 
-  if (hash_is_str(thead->ans)) {
-    copy = asm_get_str_wo_quotes(thead->ans->key);
+  if (hash_is_str(asm_op(insn->ans))) {
+    copy = asm_get_str_wo_quotes(asm_op(insn->ans)->key);
     sanitized = asm_get_str_sanitized(copy);
+    fprintf(out, "movl "VP"%s(%%rip), %%eax\n", sanitized);
   } else {
-    copy = strdup(thead->ans->key);
-    sanitized = strdup(copy);
+    fprintf(out, "movl %s, %%eax\n", asm_oploc(insn->ans));
   }
 
-  fprintf(out, "movl "VP"%s(%%rip), %%eax\n", sanitized);
   fprintf(out, "movl %%eax, %%esi\n");
 
-  if (hash_is_str(thead->ans)) {
+  if (hash_is_str(asm_op(insn->ans))) {
     fprintf(out, "leaq "VP"%s(%%rip), %%rdi\n", sanitized);
   } else { // TODO treat all as integer?
     fprintf(out, "leaq ufrgs_printf_int(%%rip), %%rdi\n");
@@ -290,53 +1100,131 @@ asm_print_print(FILE *out, struct tac_node *thead)
 }
 
 static void
-asm_print_read(FILE *out, struct tac_node *thead)
+asm_print_read(FILE *out, const struct tac_insn *insn)
 {
-  tac_validate_ops(thead, 1, __func__, __LINE__);
+  tac_validate_ops(insn, 1, __func__, __LINE__);
   if (LOG_LEVEL == LOG_LEVEL_DEBUG)
-    fprintf(out, "#Read %s\n", thead->ans->key);
-  fprintf(out, "leaq "VP"%s(%%rip), %%rsi\n", thead->ans->key);
+    fprintf(out, "#Read %s\n", asm_opkey(insn->ans));
+  // regalloc never gives read targets a register
+  fprintf(out, "leaq %s, %%rsi\n", asm_oploc(insn->ans));
   fprintf(out, "leaq ufrgs_scanf_int(%%rip), %%rdi\n");
   fprintf(out, "movl $0, %%eax\n");
   fprintf(out, "call __isoc99_scanf@PLT\n");
 }
 
 static void
-asm_print_arg(FILE *out, struct tac_node *thead, int argc)
+asm_print_arg(const struct tac_insn *insn)
 {
-  tac_validate_ops(thead, 2, __func__, __LINE__);
-  char *copy = asm_get_argname(thead->op1->astinfo, argc);
-  if (LOG_LEVEL == LOG_LEVEL_DEBUG)
-    fprintf(out, "#Arg %d (%s) = %s\n", argc, copy, thead->ans->key);
-  fprintf(out, "movl "VP"%s(%%rip), %%eax\n", thead->ans->key);
-  fprintf(out, "movl %%eax, "VP"%s(%%rip)\n", copy);
+  tac_validate_ops(insn, 2, __func__, __LINE__);
+  if (NARGS == ARGCAP) {
+    ARGCAP = ARGCAP ? 2 * ARGCAP : 8;
+    ARGS = realloc(ARGS, ARGCAP * sizeof(*ARGS));
+    if (!ARGS)
+      REPORT_AND_EXIT;
+  }
+  ARGS[NARGS++] = insn;
 }
 
 static void
-asm_print_call(FILE *out, struct tac_node *thead)
+asm_validate_argc(struct hash_node *func)
 {
-  tac_validate_ops(thead, 2, __func__, __LINE__);
-  fprintf(out, "call %s\n", thead->op1->key);
-  fprintf(out, "movl %%eax, "VP"%s(%%rip)\n", thead->ans->key);
+  if (((NARGS > 0) && (ast_func_param(func, NARGS - 1) == NULL)) || (ast_func_param(func, NARGS) != NULL))
+    LOG_AND_EXIT("Argc mismatch %zu for %s\n", NARGS, func->key);
 }
 
+/*
+ * System V call: the first ASM_NARGREGS arguments in registers, the rest
+ * pushed right to left, keeping %rsp 16-byte aligned at the call
+ */
 static void
-asm_print_tac_node(FILE *out, struct tac_node *thead)
+asm_print_call(FILE *out, const struct tac_insn *insn)
 {
-  // Assumes thread <> NULL
-  static int _argc = 0;
-  switch (thead->ttype) {
+  // ans is 0 if the result is never read
+  if (insn->op1 == 0)
+    LOG_NHEAD_AND_EXIT1(__func__, __LINE__);
+  struct hash_node *func = asm_op(insn->op1);
+  asm_validate_argc(func);
+
+  size_t nstack = (NARGS > ASM_NARGREGS) ? NARGS - ASM_NARGREGS : 0,
+         pad = 8 * (nstack % 2);
+  if (pad > 0)
+    fprintf(out, "subq $%zu, %%rsp\n", pad);
+  for (size_t k = NARGS; k-- > ASM_NARGREGS;) {
+    if (LOG_LEVEL == LOG_LEVEL_DEBUG)
+      fprintf(out, "#Arg %zu = %s\n", k, asm_opkey(ARGS[k]->ans));
+    fprintf(out, "movl %s, %%eax\n", asm_oploc(ARGS[k]->ans));
+    fprintf(out, "pushq %%rax\n");
+  }
+
+  const char *moves[ASM_NARGREGS][2];
+  size_t nmoves = (NARGS < ASM_NARGREGS) ? NARGS : ASM_NARGREGS;
+  for (size_t k = 0; k < nmoves; k++) {
+    if (LOG_LEVEL == LOG_LEVEL_DEBUG)
+      fprintf(out, "#Arg %zu = %s\n", k, asm_opkey(ARGS[k]->ans));
+    moves[k][0] = ARGREGS32[k];
+    moves[k][1] = asm_oploc(ARGS[k]->ans);
+  }
+  asm_print_moves(out, moves, nmoves);
+
+  fprintf(out, "call %s\n", func->key);
+  if (nstack + pad / 8 > 0)
+    fprintf(out, "addq $%zu, %%rsp\n", 8 * nstack + pad);
+  if (insn->ans != 0)
+    fprintf(out, "movl %%eax, %s\n", asm_oploc(insn->ans));
+  NARGS = 0;
+}
+
+static void
+asm_print_tail_call(FILE *out, const struct tac_insn *insn)
+{
+  struct hash_node *func = asm_op(insn->op1),
+                   *param = NULL;
+  asm_validate_argc(func);
+  if (LOG_LEVEL == LOG_LEVEL_DEBUG)
+    fprintf(out, "#Tail call %s\n", func->key);
+
+  const char *(*moves)[2] = calloc(NARGS ? NARGS : 1, sizeof(*moves));
+  if (!moves)
+    REPORT_AND_EXIT;
+  size_t nmoves = 0;
+  for (size_t k = 0; k < NARGS; k++) {
+    if (func != FRAME.func) {
+      moves[nmoves][0] = ARGREGS32[k];
+    } else if (((param = ast_func_param(func, k)) != NULL) && (param->opid != 0)) {
+      moves[nmoves][0] = asm_oploc(param->opid);
+    } else {
+      continue; // parameter never read
+    }
+    moves[nmoves++][1] = asm_oploc(ARGS[k]->ans);
+  }
+  asm_print_moves(out, moves, nmoves);
+  free(moves);
+
+  if (func == FRAME.func) {
+    fprintf(out, "jmp .ufrgs_tail_%s\n", func->key);
+  } else {
+    asm_print_teardown(out);
+    fprintf(out, "jmp %s\n", func->key);
+  }
+  NARGS = 0;
+}
+static void
+asm_print_tac_node(FILE *out, const struct tac_insn *insn)
+{
+  // Assumes insn <> NULL
+  switch (insn->ttype) {
     case t_sym_t:
       // Already printed on hash print
+    case t_nop_t:
       break;
     case t_label_t:
-      asm_print_label(out, thead);
+      asm_print_label(out, insn);
       break;
     case t_vread_t:
-      asm_print_vread(out, thead);
+      asm_print_vread(out, insn);
       break;
     case t_vcopy_t:
-      asm_print_vcopy(out, thead);
+      asm_print_vcopy(out, insn);
       break;
     case t_add_t:
     case t_sub_t:
@@ -350,43 +1238,41 @@ asm_print_tac_node(FILE *out, struct tac_node *thead)
     case t_ne_t:
     case t_or_t:
     case t_and_t:
-      asm_print_expr(out, thead);
+    case t_pow_t:
+      asm_print_expr(out, insn);
       break;
     case t_jmpf_t:
-      asm_print_jmpf(out, thead);
+      asm_print_jmpf(out, insn);
       break;
     case t_jmp_t:
-      asm_print_jmp(out, thead);
+      asm_print_jmp(out, insn);
       break;
     case t_fstart_t:
-      asm_print_fstart(out, thead);
+      asm_print_fstart(out, insn);
       break;
     case t_ret_t:
-      tac_validate_ops(thead, 1, __func__, __LINE__);
-      fprintf(out, "movl "VP"%s(%%rip), %%eax\n", thead->ans->key);
-      // fall through
+      tac_validate_ops(insn, 1, __func__, __LINE__);
+      fprintf(out, "movl %s, %%eax\n", asm_oploc(insn->ans));
+      asm_print_fend(out);
+      break;
     case t_fend_t:
       asm_print_fend(out);
+      FUNC++;
       break;
     case t_copy_t:
-      asm_print_copy(out, thead);
+      asm_print_copy(out, insn);
       break;
     case t_print_t:
-      asm_print_print(out, thead);
+      asm_print_print(out, insn);
       break;
     case t_read_t:
-      asm_print_read(out, thead);
+      asm_print_read(out, insn);
       break;
     case t_arg_t:
-      asm_print_arg(out, thead, _argc);
-      _argc++;
+      asm_print_arg(insn);
       break;
     case t_call_t:
-      asm_print_call(out, thead);
-      _argc = 0;
-      break;
-    case t_pow_t:
-      LOG_ERROR("Expression a^b (power) not implemented\n");
+      asm_print_call(out, insn);
       break;
     case t_not_t:
       LOG_ERROR("Expression ~a (not) not implemented\n");
@@ -398,11 +1284,19 @@ asm_print_tac_node(FILE *out, struct tac_node *thead)
 }
 
 static void
-asm_print_tacs(FILE *out, struct tac_node *thead)
+asm_print_tacs(FILE *out)
 {
-  while (thead) {
-    asm_print_tac_node(out, thead);
-    thead = thead->next;
+  for (size_t i = 0; i < PROG->ninsns; i++) {
+    const struct tac_insn *insn = &PROG->insns[i];
+    if ((i + 2 < PROG->ninsns) && asm_is_dec_jmpf(insn)) {
+      asm_print_dec_jmpf(out, insn);
+      i += 2;
+    } else if ((i + 1 < PROG->ninsns) && asm_is_cmp_jmpf(insn, insn + 1))
+      asm_print_cmp_jmpf(out, insn, &PROG->insns[++i]);
+    else if ((i + 1 < PROG->ninsns) && asm_is_tail_call(insn, insn + 1))
+      asm_print_tail_call(out, &PROG->insns[i++]);
+    else
+      asm_print_tac_node(out, insn);
   }
 }
 
@@ -430,35 +1324,28 @@ asm_print_hash_node(FILE *out, struct hash_node *hnode)
       fprintf(out, ".data\n");
       fprintf(out, ".size "VP"%s, %ld\n", hnode->key, size * 4); // TODO sizes based on type
       fprintf(out, VP"%s:\n", hnode->key);
-      vlist = hnode->astinfo->children[2];
-      // TODO ugh...
-      while (size > 0) {
-        if (vlist != NULL) {
-          if (vlist->children[0] != NULL) {
-            ast_validate_children(vlist, 1, __func__, __LINE__);
-            if (vlist->children[0]->symbol != NULL)
-              inival = asm_strtol(vlist->children[0]->symbol->key);
-            else
-              LOG_ERROR("?\n");
-          } else if (vlist->symbol != NULL) {
-            inival = asm_strtol(vlist->symbol->key);
-          } else {
+      vlist = hnode->astinfo->children[2]; // NULL if not initialized
+      for (long int i = 0; i < size; i++) {
+        if ((vlist != NULL) && ((unsigned long)i < vlist->nchildren)) {
+          struct ast_node *lit = vlist->children[i];
+          if (lit->symbol != NULL)
+            inival = asm_strtol(lit->symbol->key);
+          else
             LOG_ERROR("?\n");
-          }
           fprintf(out, ".long %ld\n", inival);
-          vlist = vlist->children[1];
         } else {
           fprintf(out, ".long 0\n");
         }
-        size--;
       }
       break;
     case hn_int_t:
+      if (!asm_is_used(hnode) || asm_is_imm(hnode->opid))
+        break; // folded away, or an immediate
       fprintf(out, ".text\n");
-      fprintf(out, ".globl "VP"%s\n", hnode->key);
+      fprintf(out, ".globl %s\n", asm_var(hnode));
       fprintf(out, ".data\n");
-      fprintf(out, ".size "VP"%s, 4\n", hnode->key); // TODO sizes based on type
-      fprintf(out, VP"%s:\n", hnode->key);
+      fprintf(out, ".size %s, 4\n", asm_var(hnode)); // TODO sizes based on type
+      fprintf(out, "%s:\n", asm_var(hnode));
       fprintf(out, ".long %s\n", hnode->key);
       break;
     case hn_str_t:
@@ -499,17 +1386,45 @@ static void
 asm_print_hash(FILE *out, struct hash_node **hhead, size_t hsize)
 {
   fprintf(out, "#HASH_START\n");
-  struct hash_node *node = NULL;
-  for (size_t i = 0; i < hsize; i++) {
-    node = hhead[i];
-    while (node != NULL) {
-      asm_print_hash_node(out, node);
-      node = node->next;
-    }
-  }
+  for (size_t i = 0; i < hsize; i++)
+    asm_print_hash_node(out, hhead[i]);
   fprintf(out, "#HASH_END\n");
 }
 
+/*
+ * Dummies are not in the hash, they are just numbered, so reserve space for
+ * the ones still in use (zeroed, in .bss)
+ */
+// Buckets the temporaries left in memory by function, for their stack slots
+static void
+asm_locals(void)
+{
+  LOCALSTART = calloc(RA.nfuncs + 2, sizeof(*LOCALSTART));
+  LOCALS = calloc(PROG->nops, sizeof(*LOCALS));
+  if (!LOCALSTART || !LOCALS)
+    REPORT_AND_EXIT;
+  for (size_t i = 1; i < PROG->nops; i++) {
+    if ((PROG->ops[i]->typeinfo.nature == hn_tmp_t) && (RA.func[i] != RA_GLOBAL) && (RA.reg[i] == RA_NONE))
+      LOCALSTART[RA.func[i] + 2]++;
+  }
+  for (size_t f = 0; f < RA.nfuncs; f++)
+    LOCALSTART[f + 2] += LOCALSTART[f + 1];
+  for (size_t i = 1; i < PROG->nops; i++) {
+    if ((PROG->ops[i]->typeinfo.nature == hn_tmp_t) && (RA.func[i] != RA_GLOBAL) && (RA.reg[i] == RA_NONE))
+      LOCALS[LOCALSTART[RA.func[i] + 1]++] = (uint32_t)i;
+  }
+}
+
+static void
+asm_print_dummies(FILE *out)
+{
+  for (size_t i = 1; i < PROG->nops; i++) {
+    // The others live in registers or stack slots
+    if ((PROG->ops[i]->typeinfo.nature == hn_tmp_t) && USED[i] && (RA.func[i] == RA_GLOBAL))
+      fprintf(out, ".lcomm %s, 4\n", asm_opvar((uint32_t)i)); // TODO sizes based on type
+  }
+}
+
 static void
 asm_print_fixed_init(FILE *out)
 {
@@ -522,9 +1437,28 @@ asm_print_fixed_init(FILE *out)
 }
 
 void
-asm_print(FILE *out, struct tac_node *thead, struct hash_node **hhead, size_t hsize)
+asm_print(FILE *out, const struct tac_prog *prog, struct hash_node **hhead, size_t hsize)
 {
-  asm_print_tacs(out, thead);
+  PROG = prog;
+  FUNC = 0;
+  RA = regalloc_run(prog);
+  asm_print_names();
+  asm_locals();
+  asm_vec_bases();
+  asm_print_tacs(out);
   asm_print_hash(out, hhead, hsize);
+  asm_print_dummies(out);
   asm_print_fixed_init(out);
+  asm_free_names();
+  free(LOCALSTART);
+  free(LOCALS);
+  free(ARGS);
+  free(VECBASE);
+  VECBASE = NULL;
+  LOCALSTART = NULL;
+  LOCALS = NULL;
+  ARGS = NULL;
+  NARGS = ARGCAP = 0;
+  regalloc_free(&RA);
+  PROG = NULL;
 }
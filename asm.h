@@ -3,7 +3,8 @@
 #include "tac.h"
 
 /*
- * Dado uma lista de TACs, imprime ASM
+ * Dado um programa em TACs e os hsize símbolos em hhead (HASH_TABLE.order),
+ * imprime ASM
  */
 void
-asm_print(FILE *out, struct tac_node *thead, struct hash_node **hhead, size_t hsize);
+asm_print(FILE *out, const struct tac_prog *prog, struct hash_node **hhead, size_t hsize);
@@ -5,6 +5,11 @@
 #include "ast.h"
 #include "errors.h"
 
+struct ast_node *AST_HEAD = NULL;
+
+// Todos os nodos são alocados aqui e liberados juntos em ast_free
+static struct arena AST_ARENA = { NULL };
+
 static void
 ast_print_disassemble_node(FILE *out, struct ast_node *head);
 
@@ -23,7 +28,7 @@ ast_kw_to_str(struct ast_node *head)
 void
 ast_validate_children(struct ast_node *head, size_t nchildren, const char *caller, int line)
 {
-  if ((NUM_CHILDREN < nchildren) || (head == NULL) || (head->children == NULL))
+  if ((head == NULL) || (head->nchildren < nchildren))
     LOG_NHEAD_AND_EXIT1(caller, line);
 
   for (size_t i = 0; i < nchildren; i++) {
@@ -35,7 +40,7 @@ ast_validate_children(struct ast_node *head, size_t nchildren, const char *calle
 void
 ast_validate_symbol(struct ast_node *head, size_t nchildren, const char *caller, int line)
 {
-  if ((NUM_CHILDREN < nchildren) || (head == NULL) || (head->children == NULL))
+  if ((head == NULL) || (head->nchildren < nchildren))
     LOG_NHEAD_AND_EXIT1(caller, line);
 
   for (size_t i = 0; i < nchildren; i++) {
@@ -47,6 +52,16 @@ ast_validate_symbol(struct ast_node *head, size_t nchildren, const char *caller,
   }
 }
 
+struct hash_node *
+ast_func_param(struct hash_node *func, size_t k)
+{
+  struct ast_node *params = func->astinfo; // NULL se não tem parâmetros
+  if ((params == NULL) || (k >= params->nchildren))
+    return NULL;
+  ast_validate_symbol(params->children[k], 1, __func__, __LINE__);
+  return params->children[k]->children[0]->symbol;
+}
+
 struct ast_node *
 ast_create(enum atype_t atype, struct hash_node *symbol, size_t nchildren, ...)
 {
@@ -55,11 +70,10 @@ ast_create(enum atype_t atype, struct hash_node *symbol, size_t nchildren, ...)
     exit(E_SYNTAX);
   }
 
-  struct ast_node *ans = malloc(sizeof(*ans));
-  if (!ans)
-    REPORT_AND_EXIT;
+  struct ast_node *ans = arena_alloc(&AST_ARENA, sizeof(*ans) + nchildren * sizeof(ans->children[0]));
 
   ans->atype = atype;
+  ans->nchildren = (unsigned int)nchildren;
   ans->symbol = symbol;
 
   va_list va;
@@ -71,11 +85,35 @@ ast_create(enum atype_t atype, struct hash_node *symbol, size_t nchildren, ...)
 
   va_end(va);
 
-  for (size_t n = nchildren; n < NUM_CHILDREN; n++) {
-    ans->children[n] = NULL;
+  return ans;
+}
+
+struct ast_node *
+ast_append(struct ast_node *head, struct ast_node *child)
+{
+  size_t n = head->nchildren;
+
+  // Cheia quando n é zero ou potência de 2, ver ast.h
+  if ((n & (n - 1)) == 0) {
+    size_t cap = n ? 2 * n : 1;
+    struct ast_node *grown = arena_alloc(&AST_ARENA, sizeof(*grown) + cap * sizeof(grown->children[0]));
+    grown->atype = head->atype;
+    grown->nchildren = head->nchildren;
+    grown->symbol = head->symbol;
+    for (size_t i = 0; i < n; i++)
+      grown->children[i] = head->children[i];
+    head = grown;
   }
 
-  return ans;
+  head->children[head->nchildren++] = child;
+  return head;
+}
+
+void
+ast_free(void)
+{
+  arena_free(&AST_ARENA);
+  AST_HEAD = NULL;
 }
 
 void
@@ -161,12 +199,10 @@ ast_print(struct ast_node *head, int level)
   ast_print_node(head, level);
 
 
-  // Provavelmente tem um jeito melhor de fazer este laço
-  for (size_t nchild = 0; nchild < NUM_CHILDREN; nchild++) {
+  for (size_t nchild = 0; nchild < head->nchildren; nchild++) {
     struct ast_node *child = head->children[nchild];
-    if (child == NULL)
-      break;
-    ast_print(child, level + 1);
+    if (child != NULL)
+      ast_print(child, level + 1);
   }
 }
 
@@ -218,13 +254,10 @@ ast_print_disassemble_vlist(FILE *out, struct ast_node *head)
   if (head == NULL)
     return;
 
-  ast_validate_children(head, 2, __func__, __LINE__);
-
-  ast_validate_symbol(head, 1, __func__, __LINE__);
-
-  fprintf(out, "%s ", head->children[0]->symbol->key);
+  ast_validate_symbol(head, head->nchildren, __func__, __LINE__);
 
-  ast_print_disassemble_node(out, head->children[1]);
+  for (size_t i = 0; i < head->nchildren; i++)
+    fprintf(out, "%s ", head->children[i]->symbol->key);
 }
 
 static void
@@ -293,15 +326,12 @@ ast_print_disassemble_csv(FILE *out, struct ast_node *head)
   if (head == NULL)
     return;
 
-  ast_validate_children(head, 0, __func__, __LINE__);
+  ast_validate_children(head, head->nchildren, __func__, __LINE__);
 
-  if (head->children[0] != NULL) {
-    ast_print_disassemble_node(out, head->children[0]);
-
-    if (head->children[1] != NULL) {
+  for (size_t i = 0; i < head->nchildren; i++) {
+    if (i > 0)
       fprintf(out, ", ");
-      ast_print_disassemble_node(out, head->children[1]);
-    }
+    ast_print_disassemble_node(out, head->children[i]);
   }
 }
 
@@ -326,16 +356,11 @@ ast_print_disassemble_cmdl(FILE *out, struct ast_node *head)
   if (head == NULL)
     return;
 
-  ast_validate_children(head, 0, __func__, __LINE__);
-
-  if (head->children[0] != NULL) {
-    ast_print_disassemble_node(out, head->children[0]);
+  ast_validate_children(head, head->nchildren, __func__, __LINE__);
 
+  for (size_t i = 0; i < head->nchildren; i++) {
+    ast_print_disassemble_node(out, head->children[i]);
     fprintf(out, "\n");
-
-    if (head->children[1] != NULL) {
-      ast_print_disassemble_node(out, head->children[1]);
-    }
   }
 }
 
@@ -370,17 +395,11 @@ ast_print_disassemble_plist(FILE *out, struct ast_node *head)
   if (head == NULL)
     return;
 
-  ast_validate_children(head, 0, __func__, __LINE__);
-
-  if (head->children[0] != NULL) {
-    ast_print_disassemble_node(out, head->children[0]);
-
-    // fdecl e decl são quem imprimem porque é o que está no parser.y
-    //fprintf(out, ";\n");
+  ast_validate_children(head, head->nchildren, __func__, __LINE__);
 
-    if (head->children[1] != NULL)
-      ast_print_disassemble_plist(out, head->children[1]);
-  }
+  // fdecl e decl são quem imprimem ";\n" porque é o que está no parser.y
+  for (size_t i = 0; i < head->nchildren; i++)
+    ast_print_disassemble_node(out, head->children[i]);
 }
 
 static void
@@ -4,11 +4,11 @@
 #include <stdio.h>
 #include <stddef.h>
 #include "hash.h"
+#include "arena.h"
 #include "errors.h"
 
-// Número fixo de filhos por simplicidade. 10 deve ser mais do que o suficiente
+// Número máximo de filhos de um nodo que não é lista (o loop tem 5)
 #define NUM_CHILDREN 10
-#define MAX_ARGC 50
 
 #define LOG_NSYM_AND_EXIT\
   do{\
@@ -93,21 +93,43 @@ enum atype_t {
   a_tvar_t
 };
 
+/*
+ * O nodo tem exatamente nchildren filhos, alocados junto a ele. Acessar
+ * children[i] com i >= nchildren é inválido. Filhos podem ser NULL (bloco
+ * vazio, else ausente, etc).
+ */
 struct ast_node {
   enum atype_t atype;
+  unsigned int nchildren;
   struct hash_node *symbol;
-  struct ast_node *children[NUM_CHILDREN];
+  struct ast_node *children[];
 };
 
-struct ast_node *AST_HEAD;
+extern struct ast_node *AST_HEAD;
 
 /*
- * Retorna um novo nodo ast alocado dinamicamente com tipo atype, símbolo
+ * Retorna um novo nodo ast, alocado na arena da AST, com tipo atype, símbolo
  * symbol, e nchildren do tipo struct ast_node * (passados em __VA_LIST__)
  */
 struct ast_node *
 ast_create(enum atype_t atype, struct hash_node *symbol, size_t nchildren, ...);
 
+/*
+ * Adiciona child ao fim da lista (a_plist_t, a_cmdl_t, a_csv_t, a_vlist_t)
+ * head e retorna a lista, que pode ter sido realocada: use sempre o retorno.
+ * A capacidade de uma lista é nchildren arredondado para cima para potência
+ * de 2, então adicionar é O(1) amortizado. Só funciona para nodos criados
+ * com até 2 filhos e aumentados apenas por esta função.
+ */
+struct ast_node *
+ast_append(struct ast_node *head, struct ast_node *child);
+
+/*
+ * Libera todos os nodos da AST de uma vez
+ */
+void
+ast_free(void);
+
 /*
  * Imprime para stdout o nodo passado e toda sua sub-árvore, identando level
  */
@@ -127,7 +149,7 @@ void
 ast_print_disassemble(FILE *out, struct ast_node *head);
 
 /*
- * Se head não tem pelo menos nchildren != NULL, loga erro e exit
+ * Se head não tem pelo menos nchildren filhos != NULL, loga erro e exit
  */
 void
 ast_validate_children(struct ast_node *head, size_t nchildren, const char *caller, int line);
@@ -138,3 +160,10 @@ ast_validate_children(struct ast_node *head, size_t nchildren, const char *calle
  */
 void
 ast_validate_symbol(struct ast_node *head, size_t nchildren, const char *caller, int line);
+
+/*
+ * Parâmetro k da função (a lista de parâmetros fica no astinfo do símbolo da
+ * função), NULL se ela tem menos parâmetros
+ */
+struct hash_node *
+ast_func_param(struct hash_node *func, size_t k);
@@ -0,0 +1,489 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "cfg.h"
+#include "logging.h"
+
+static void *
+cfg_alloc(size_t n, size_t size)
+{
+  // n pode ser 0 (programa sem funções), mas queremos um ponteiro válido
+  void *ans = malloc((n ? n : 1) * size);
+  if (!ans)
+    REPORT_AND_EXIT;
+  return ans;
+}
+
+static bool
+cfg_ends_block(enum ttype_t ttype)
+{
+  return (ttype == t_jmp_t) || (ttype == t_jmpf_t) || (ttype == t_ret_t) || (ttype == t_fend_t);
+}
+
+/*
+ * Acha as funções e quebra cada uma em blocos: um bloco começa no t_fstart_t,
+ * em cada label e após cada desvio ou retorno.
+ */
+static void
+cfg_build_blocks(struct cfg *cfg, const struct tac_prog *prog)
+{
+  size_t nfuncs = 0,
+         nblocks = 0,
+         fstart = CFG_NONE;
+
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    enum ttype_t ttype = prog->insns[i].ttype;
+    if (ttype == t_fstart_t) {
+      if (fstart != CFG_NONE)
+        LOG_AND_EXIT("Nested function at TAC %zu\n", i);
+      fstart = i;
+      nfuncs++;
+      nblocks++;
+    } else if (fstart != CFG_NONE) {
+      if ((ttype == t_label_t) && !cfg_ends_block(prog->insns[i - 1].ttype))
+        nblocks++;
+      if (ttype == t_fend_t)
+        fstart = CFG_NONE;
+      else if (cfg_ends_block(ttype))
+        nblocks++;
+    }
+  }
+  if (fstart != CFG_NONE)
+    LOG_AND_EXIT("Function without end at TAC %zu\n", fstart);
+
+  cfg->funcs = cfg_alloc(nfuncs, sizeof(*cfg->funcs));
+  cfg->blocks = cfg_alloc(nblocks, sizeof(*cfg->blocks));
+  cfg->insnblock = cfg_alloc(prog->ninsns, sizeof(*cfg->insnblock));
+  cfg->nfuncs = 0;
+  cfg->nblocks = 0;
+
+  struct cfg_func *func = NULL;
+  struct cfg_block *block = NULL;
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    enum ttype_t ttype = prog->insns[i].ttype;
+    if (ttype == t_fstart_t) {
+      func = &cfg->funcs[cfg->nfuncs++];
+      func->fstart = i;
+      func->first = cfg->nblocks;
+      block = NULL;
+    } else if (func == NULL) {
+      cfg->insnblock[i] = CFG_NONE;
+      continue;
+    } else if (ttype == t_label_t) {
+      block = NULL;
+    }
+
+    if (block == NULL) {
+      block = &cfg->blocks[cfg->nblocks++];
+      block->first = i;
+      block->func = cfg->nfuncs - 1;
+    }
+    block->end = i + 1;
+    cfg->insnblock[i] = cfg->nblocks - 1;
+
+    if (ttype == t_fend_t) {
+      func->fend = i;
+      func->end = cfg->nblocks;
+      func = NULL;
+    }
+    if (cfg_ends_block(ttype))
+      block = NULL;
+  }
+}
+
+static size_t
+cfg_target(const struct cfg *cfg, const struct tac_insn *insn)
+{
+  size_t ans = cfg->labelblock[insn->ans];
+  if (ans == CFG_NONE)
+    LOG_AND_EXIT("Jump to a label outside of any function\n");
+  return ans;
+}
+
+/*
+ * Sucessores pela última instrução de cada bloco, e predecessores a partir
+ * deles
+ */
+static void
+cfg_build_edges(struct cfg *cfg, const struct tac_prog *prog)
+{
+  cfg->labelblock = cfg_alloc(prog->nops, sizeof(*cfg->labelblock));
+  for (size_t i = 0; i < prog->nops; i++)
+    cfg->labelblock[i] = CFG_NONE;
+  for (size_t i = 0; i < cfg->nblocks; i++) {
+    const struct tac_insn *insn = &prog->insns[cfg->blocks[i].first];
+    if (insn->ttype == t_label_t)
+      cfg->labelblock[insn->ans] = i;
+  }
+
+  size_t npreds = 0;
+  for (size_t i = 0; i < cfg->nblocks; i++) {
+    struct cfg_block *block = &cfg->blocks[i];
+    const struct tac_insn *last = &prog->insns[block->end - 1];
+    bool falls = (i + 1 < cfg->funcs[block->func].end);
+    block->nsucc = 0;
+    block->npred = 0;
+    switch (last->ttype) {
+      case t_jmp_t:
+        block->succ[block->nsucc++] = cfg_target(cfg, last);
+        break;
+      case t_jmpf_t:
+        if (falls)
+          block->succ[block->nsucc++] = i + 1;
+        if ((block->nsucc == 0) || (cfg_target(cfg, last) != i + 1))
+          block->succ[block->nsucc++] = cfg_target(cfg, last);
+        break;
+      case t_ret_t:
+      case t_fend_t:
+        break;
+      default:
+        if (falls)
+          block->succ[block->nsucc++] = i + 1;
+    }
+    npreds += block->nsucc;
+  }
+
+  for (size_t i = 0; i < cfg->nblocks; i++) {
+    for (unsigned int j = 0; j < cfg->blocks[i].nsucc; j++)
+      cfg->blocks[cfg->blocks[i].succ[j]].npred++;
+  }
+  size_t pos = 0;
+  for (size_t i = 0; i < cfg->nblocks; i++) {
+    cfg->blocks[i].pred = pos;
+    pos += cfg->blocks[i].npred;
+    cfg->blocks[i].npred = 0;
+  }
+  cfg->preds = cfg_alloc(npreds, sizeof(*cfg->preds));
+  for (size_t i = 0; i < cfg->nblocks; i++) {
+    for (unsigned int j = 0; j < cfg->blocks[i].nsucc; j++) {
+      struct cfg_block *succ = &cfg->blocks[cfg->blocks[i].succ[j]];
+      cfg->preds[succ->pred + succ->npred++] = i;
+    }
+  }
+}
+
+/*
+ * Pós-ordem reversa dos blocos alcançáveis de cada função, com uma busca em
+ * profundidade iterativa (stack e próximo sucessor de cada bloco)
+ */
+static void
+cfg_build_rpo(struct cfg *cfg)
+{
+  size_t *stack = cfg_alloc(cfg->nblocks, sizeof(*stack));
+  unsigned int *next = cfg_alloc(cfg->nblocks, sizeof(*next));
+  cfg->rpo = cfg_alloc(cfg->nblocks, sizeof(*cfg->rpo));
+  cfg->nrpo = 0;
+
+  for (size_t i = 0; i < cfg->nblocks; i++) {
+    cfg->blocks[i].rpo = CFG_NONE;
+    next[i] = 0;
+  }
+
+  for (size_t f = 0; f < cfg->nfuncs; f++) {
+    // A pós-ordem é escrita de trás para frente no fim do trecho da função
+    size_t base = cfg->nrpo,
+           npost = 0,
+           nstack = 0;
+    stack[nstack++] = cfg->funcs[f].first;
+    cfg->blocks[cfg->funcs[f].first].rpo = 0; // visitado
+    while (nstack > 0) {
+      size_t b = stack[nstack - 1];
+      struct cfg_block *block = &cfg->blocks[b];
+      if (next[b] < block->nsucc) {
+        size_t s = block->succ[next[b]++];
+        if (cfg->blocks[s].rpo == CFG_NONE) {
+          cfg->blocks[s].rpo = 0;
+          stack[nstack++] = s;
+        }
+      } else {
+        nstack--;
+        stack[cfg->nblocks - 1 - npost++] = b;
+      }
+    }
+    // stack[nblocks - npost, nblocks) tem a pós-ordem invertida, isto é, a
+    // pós-ordem reversa
+    for (size_t i = 0; i < npost; i++) {
+      size_t b = stack[cfg->nblocks - npost + i];
+      cfg->rpo[base + i] = b;
+      cfg->blocks[b].rpo = base + i;
+    }
+    cfg->nrpo += npost;
+  }
+
+  free(stack);
+  free(next);
+}
+
+static size_t
+cfg_intersect(const struct cfg *cfg, size_t a, size_t b)
+{
+  while (a != b) {
+    while (cfg->blocks[a].rpo > cfg->blocks[b].rpo)
+      a = cfg->blocks[a].idom;
+    while (cfg->blocks[b].rpo > cfg->blocks[a].rpo)
+      b = cfg->blocks[b].idom;
+  }
+  return a;
+}
+
+/*
+ * Dominadores imediatos (Cooper, Harvey e Kennedy, "A Simple, Fast Dominance
+ * Algorithm"), seguidos de uma numeração pré/pós-ordem da árvore de
+ * dominadores para responder cfg_dominates em O(1)
+ */
+static void
+cfg_build_doms(struct cfg *cfg)
+{
+  for (size_t i = 0; i < cfg->nblocks; i++)
+    cfg->blocks[i].idom = CFG_NONE;
+
+  for (size_t f = 0; f < cfg->nfuncs; f++) {
+    size_t entry = cfg->funcs[f].first,
+           first = cfg->blocks[entry].rpo;
+    size_t end = first;
+    while ((end < cfg->nrpo) && (cfg->blocks[cfg->rpo[end]].func == f))
+      end++;
+    cfg->blocks[entry].idom = entry;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t r = first + 1; r < end; r++) {
+        struct cfg_block *block = &cfg->blocks[cfg->rpo[r]];
+        size_t idom = CFG_NONE;
+        for (size_t p = 0; p < block->npred; p++) {
+          size_t pred = cfg->preds[block->pred + p];
+          if (cfg->blocks[pred].idom == CFG_NONE)
+            continue;
+          idom = (idom == CFG_NONE) ? pred : cfg_intersect(cfg, pred, idom);
+        }
+        if (block->idom != idom) {
+          block->idom = idom;
+          changed = true;
+        }
+      }
+    }
+    cfg->blocks[entry].idom = CFG_NONE;
+  }
+
+  // Filhos de cada bloco na árvore, em CSR: filhos de b são
+  // kids[start[b], start[b + 1])
+  size_t *start = cfg_alloc(cfg->nblocks + 1, sizeof(*start)),
+         *kids = cfg_alloc(cfg->nblocks, sizeof(*kids)),
+         *stack = cfg_alloc(cfg->nblocks, sizeof(*stack)),
+         *next = cfg_alloc(cfg->nblocks, sizeof(*next));
+  for (size_t i = 0; i <= cfg->nblocks; i++)
+    start[i] = 0;
+  for (size_t i = 0; i < cfg->nblocks; i++) {
+    if (cfg->blocks[i].idom != CFG_NONE)
+      start[cfg->blocks[i].idom + 1]++;
+  }
+  for (size_t i = 0; i < cfg->nblocks; i++) {
+    start[i + 1] += start[i];
+    next[i] = start[i];
+  }
+  for (size_t i = 0; i < cfg->nblocks; i++) {
+    if (cfg->blocks[i].idom != CFG_NONE)
+      kids[next[cfg->blocks[i].idom]++] = i;
+    cfg->blocks[i].dpre = cfg->blocks[i].dpost = CFG_NONE;
+  }
+
+  size_t counter = 0;
+  for (size_t f = 0; f < cfg->nfuncs; f++) {
+    size_t nstack = 0;
+    stack[nstack++] = cfg->funcs[f].first;
+    next[cfg->funcs[f].first] = start[cfg->funcs[f].first];
+    cfg->blocks[cfg->funcs[f].first].dpre = counter++;
+    while (nstack > 0) {
+      size_t b = stack[nstack - 1];
+      if (next[b] < start[b + 1]) {
+        size_t kid = kids[next[b]++];
+        next[kid] = start[kid];
+        cfg->blocks[kid].dpre = counter++;
+        stack[nstack++] = kid;
+      } else {
+        cfg->blocks[b].dpost = counter++;
+        nstack--;
+      }
+    }
+  }
+
+  free(start);
+  free(kids);
+  free(stack);
+  free(next);
+}
+
+bool
+cfg_dominates(const struct cfg *cfg, size_t a, size_t b)
+{
+  const struct cfg_block *ba = &cfg->blocks[a],
+                         *bb = &cfg->blocks[b];
+  if ((ba->dpre == CFG_NONE) || (bb->dpre == CFG_NONE))
+    return false;
+  return (ba->dpre <= bb->dpre) && (bb->dpost <= ba->dpost);
+}
+
+/*
+ * Laços naturais: para cada aresta de retorno n -> h (h domina n), o corpo
+ * são os blocos que alcançam n sem passar por h. Cabeçalhos são visitados em
+ * pós-ordem reversa, então laços externos são criados antes dos internos.
+ */
+static void
+cfg_build_loops(struct cfg *cfg)
+{
+  size_t *mark = cfg_alloc(cfg->nblocks, sizeof(*mark)),
+         *stack = cfg_alloc(cfg->nblocks, sizeof(*stack));
+  size_t loopcap = 0,
+         bodycap = 0,
+         nbody = 0;
+  cfg->loops = NULL;
+  cfg->loopblocks = NULL;
+  cfg->nloops = 0;
+
+  for (size_t i = 0; i < cfg->nblocks; i++) {
+    mark[i] = CFG_NONE;
+    cfg->blocks[i].loop = CFG_NONE;
+    cfg->blocks[i].depth = 0;
+  }
+
+  for (size_t r = 0; r < cfg->nrpo; r++) {
+    size_t h = cfg->rpo[r],
+           nstack = 0;
+    struct cfg_block *header = &cfg->blocks[h];
+    bool selfloop = false; // laço de um bloco só, já começa no corpo
+    for (size_t p = 0; p < header->npred; p++) {
+      size_t pred = cfg->preds[header->pred + p];
+      if (pred == h) {
+        selfloop = true;
+      } else if (cfg_dominates(cfg, h, pred) && (mark[pred] != cfg->nloops)) {
+        mark[pred] = cfg->nloops;
+        stack[nstack++] = pred;
+      }
+    }
+    if ((nstack == 0) && !selfloop)
+      continue;
+
+    if (cfg->nloops == loopcap) {
+      loopcap = loopcap ? loopcap * 2 : 16;
+      cfg->loops = realloc(cfg->loops, loopcap * sizeof(*cfg->loops));
+      if (!cfg->loops)
+        REPORT_AND_EXIT;
+    }
+    struct cfg_loop *loop = &cfg->loops[cfg->nloops];
+    loop->header = h;
+    loop->parent = header->loop;
+    loop->body = nbody;
+    mark[h] = cfg->nloops;
+
+    // Blocos alcançáveis de trás para frente a partir das arestas de retorno
+    size_t x = h;
+    for (;;) {
+      if (nbody == bodycap) {
+        bodycap = bodycap ? bodycap * 2 : 64;
+        cfg->loopblocks = realloc(cfg->loopblocks, bodycap * sizeof(*cfg->loopblocks));
+        if (!cfg->loopblocks)
+          REPORT_AND_EXIT;
+      }
+      cfg->loopblocks[nbody++] = x;
+      cfg->blocks[x].loop = cfg->nloops;
+      cfg->blocks[x].depth++;
+      if (nstack == 0)
+        break;
+      x = stack[--nstack];
+      struct cfg_block *block = &cfg->blocks[x];
+      for (size_t p = 0; p < block->npred; p++) {
+        size_t pred = cfg->preds[block->pred + p];
+        if ((cfg->blocks[pred].rpo != CFG_NONE) && (mark[pred] != cfg->nloops)) {
+          mark[pred] = cfg->nloops;
+          stack[nstack++] = pred;
+        }
+      }
+    }
+    loop->nbody = nbody - loop->body;
+    cfg->nloops++;
+  }
+
+  free(mark);
+  free(stack);
+}
+
+struct cfg
+cfg_build(const struct tac_prog *prog)
+{
+  struct cfg ans;
+  cfg_build_blocks(&ans, prog);
+  cfg_build_edges(&ans, prog);
+  cfg_build_rpo(&ans);
+  cfg_build_doms(&ans);
+  cfg_build_loops(&ans);
+  return ans;
+}
+
+void
+cfg_free(struct cfg *cfg)
+{
+  free(cfg->blocks);
+  free(cfg->funcs);
+  free(cfg->loops);
+  free(cfg->preds);
+  free(cfg->loopblocks);
+  free(cfg->rpo);
+  free(cfg->insnblock);
+  free(cfg->labelblock);
+  cfg->blocks = NULL;
+  cfg->funcs = NULL;
+  cfg->loops = NULL;
+  cfg->preds = NULL;
+  cfg->loopblocks = NULL;
+  cfg->rpo = NULL;
+  cfg->insnblock = NULL;
+  cfg->labelblock = NULL;
+  cfg->nblocks = cfg->nfuncs = cfg->nloops = cfg->nrpo = 0;
+}
+
+static void
+cfg_print_index(FILE *f, size_t i)
+{
+  if (i == CFG_NONE)
+    fprintf(f, "-");
+  else
+    fprintf(f, "B%zu", i);
+}
+
+void
+cfg_print(FILE *f, const struct cfg *cfg, const struct tac_prog *prog)
+{
+  for (size_t fi = 0; fi < cfg->nfuncs; fi++) {
+    const struct cfg_func *func = &cfg->funcs[fi];
+    fprintf(f, "function ");
+    hash_fprint_key(f, prog->ops[prog->insns[func->fstart].ans]);
+    fprintf(f, "\n");
+    for (size_t b = func->first; b < func->end; b++) {
+      const struct cfg_block *block = &cfg->blocks[b];
+      fprintf(f, "  B%zu [%zu, %zu) succ:", b, block->first, block->end);
+      for (unsigned int s = 0; s < block->nsucc; s++) {
+        fprintf(f, " ");
+        cfg_print_index(f, block->succ[s]);
+      }
+      fprintf(f, " pred:");
+      for (size_t p = 0; p < block->npred; p++) {
+        fprintf(f, " ");
+        cfg_print_index(f, cfg->preds[block->pred + p]);
+      }
+      fprintf(f, " idom: ");
+      cfg_print_index(f, block->idom);
+      fprintf(f, " depth: %u%s\n", block->depth, (block->rpo == CFG_NONE) ? " unreachable" : "");
+    }
+  }
+  for (size_t l = 0; l < cfg->nloops; l++) {
+    const struct cfg_loop *loop = &cfg->loops[l];
+    fprintf(f, "L%zu header: B%zu parent: ", l, loop->header);
+    if (loop->parent == CFG_NONE)
+      fprintf(f, "-");
+    else
+      fprintf(f, "L%zu", loop->parent);
+    fprintf(f, " body:");
+    for (size_t i = 0; i < loop->nbody; i++)
+      fprintf(f, " B%zu", cfg->loopblocks[loop->body + i]);
+    fprintf(f, "\n");
+  }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "tac.h"
+
+/*
+ * Índice inválido (bloco inexistente, sem dominador, fora de laço, etc)
+ */
+#define CFG_NONE ((size_t)-1)
+
+/*
+ * Bloco básico: as instruções insns[first, end) da tac_prog. Só é possível
+ * entrar pela primeira e sair pela última.
+ */
+struct cfg_block {
+  size_t first, end;
+  size_t func;      // índice em cfg.funcs
+  size_t succ[2];   // fallthrough (ou destino do jmp) e destino do jmpf
+  unsigned int nsucc;
+  size_t pred;      // predecessores em cfg.preds[pred, pred + npred)
+  size_t npred;
+  size_t rpo;       // posição na ordem pós-ordem reversa, CFG_NONE se inalcançável
+  size_t idom;      // dominador imediato, CFG_NONE para a entrada e inalcançáveis
+  size_t dpre, dpost; // numeração da árvore de dominadores, ver cfg_dominates
+  size_t loop;      // laço mais interno que contém o bloco, CFG_NONE se nenhum
+  unsigned int depth; // quantidade de laços que contém o bloco
+};
+
+/*
+ * Função: instruções insns[fstart, fend] e blocos blocks[first, end). O
+ * primeiro bloco, que contém o t_fstart_t, é a entrada.
+ */
+struct cfg_func {
+  size_t fstart, fend;
+  size_t first, end;
+};
+
+/*
+ * Laço natural: o cabeçalho domina todos os blocos do corpo, que estão em
+ * cfg.loopblocks[body, body + nbody) (o cabeçalho incluso). Laços com o mesmo
+ * cabeçalho são unidos.
+ */
+struct cfg_loop {
+  size_t header;
+  size_t body, nbody;
+  size_t parent; // laço imediatamente externo, CFG_NONE se nenhum
+};
+
+/*
+ * Grafo de fluxo de controle de uma tac_prog. Instruções fora de funções
+ * (declarações globais) não pertencem a bloco algum.
+ *
+ * Os índices referem-se à tac_prog como estava em cfg_build. Qualquer passagem
+ * que mude as instruções deve reconstruir o grafo.
+ */
+struct cfg {
+  struct cfg_block *blocks;
+  size_t nblocks;
+  struct cfg_func *funcs;
+  size_t nfuncs;
+  struct cfg_loop *loops; // externos antes dos internos
+  size_t nloops;
+  size_t *preds;
+  size_t *loopblocks;
+  size_t *rpo;        // blocos alcançáveis de cada função, em pós-ordem reversa
+  size_t nrpo;
+  size_t *insnblock;  // bloco de cada instrução, CFG_NONE fora de funções
+  size_t *labelblock; // bloco de cada label, por id de operando
+};
+
+/*
+ * Divide o programa em blocos básicos e calcula arestas, dominadores e laços.
+ * Blocos e arestas saem em tempo linear no tamanho do programa; os dominadores
+ * usam o algoritmo iterativo de Cooper, Harvey e Kennedy, que costuma
+ * convergir em poucas passadas pela RPO mas é quadrático no pior caso.
+ */
+struct cfg
+cfg_build(const struct tac_prog *prog);
+
+/*
+ * Libera o grafo (não a tac_prog)
+ */
+void
+cfg_free(struct cfg *cfg);
+
+/*
+ * Se o bloco a domina o bloco b, em O(1). Blocos inalcançáveis não dominam
+ * nem são dominados.
+ */
+bool
+cfg_dominates(const struct cfg *cfg, size_t a, size_t b);
+
+/*
+ * Imprime os blocos, arestas, dominadores e laços. Para debug.
+ */
+void
+cfg_print(FILE *f, const struct cfg *cfg, const struct tac_prog *prog);
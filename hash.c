@@ -1,86 +1,133 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include "hash.h"
 #include "logging.h"
 
-struct _hash_node_and_addr {
-  struct hash_node *node;
-  size_t addr;
-};
+struct hash_table HASH_TABLE = { NULL, 0, 0, NULL, 0, { NULL } };
 
+// Contadores dos temporários e labels, ver hash_create_anon
+static size_t DUMMYCT = 0;
+static size_t LABELCT = 0;
 
 /*
- * Retorna um endreço dada uma chave.
+ * FNV-1a de 64 bits seguido do finalizador do MurmurHash3, para que os bits
+ * baixos (os únicos usados no endereço) dependam de todos os bytes da chave.
  */
 static size_t
-hash_address(char *key)
+hash_string(const char *key, size_t len)
 {
-  size_t ans = 1;
-  for (size_t i = 0; i < strlen(key); i++)
-    ans = (ans * (size_t)key[i]) % HASH_SIZE + 1;
-  return ans - 1;
+  uint64_t ans = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    ans ^= (unsigned char)key[i];
+    ans *= 1099511628211ULL;
+  }
+  ans ^= ans >> 33;
+  ans *= 0xff51afd7ed558ccdULL;
+  ans ^= ans >> 33;
+  ans *= 0xc4ceb9fe1a85ec53ULL;
+  ans ^= ans >> 33;
+  return (size_t)ans;
+}
+
+static struct hash_node **
+hash_alloc_slots(size_t size)
+{
+  struct hash_node **ans = calloc(size, sizeof(*ans));
+  if (!ans)
+    REPORT_AND_EXIT;
+  return ans;
 }
 
 void
 hash_init(void)
 {
-  for (size_t i = 0; i < HASH_SIZE; i++)
-    HASH_TABLE[i] = NULL;
+  HASH_TABLE.slots = hash_alloc_slots(HASH_INIT_SIZE);
+  HASH_TABLE.size = HASH_INIT_SIZE;
+  HASH_TABLE.used = 0;
+  HASH_TABLE.order = NULL;
+  HASH_TABLE.ordercap = 0;
 }
 
 /*
- * Procura uma chave na hash, preenchendo a estrutura out, pré-alocada, com o
- * nodo encontrado e seu endereço. Se não encontrar, o nodo é NULL e o endereço
- * é zero. Para uso interno.
+ * Retorna o slot da chave: o que contém o nodo, se existir, ou o slot vazio
+ * onde ele deveria ser inserido. Para uso interno.
  */
-static void
-_hash_find(char *key, struct _hash_node_and_addr *out)
+static size_t
+hash_probe(const char *key, size_t len, size_t hash)
 {
-  size_t addr = hash_address(key);
-  struct hash_node *node = HASH_TABLE[addr];
-  // isto não é muito inteligente, mas funciona
+  size_t mask = HASH_TABLE.size - 1;
+  size_t addr = hash & mask;
+  struct hash_node *node = HASH_TABLE.slots[addr];
   while (node != NULL) {
-    if (strcmp(node->key, key) == 0) {
-      out->node = node;
-      out->addr = addr;
-      return;
-    } else {
-      node = node->next;
-    }
+    if ((node->hash == hash) && (node->len == len) && (memcmp(node->key, key, len) == 0))
+      break;
+    addr = (addr + 1) & mask;
+    node = HASH_TABLE.slots[addr];
   }
-  out->node = NULL;
-  out->addr = 0;
-  return;
+  return addr;
+}
+
+/*
+ * Dobra a tabela e reinsere os nodos, sem recalcular os hashes.
+ */
+static void
+hash_grow(void)
+{
+  struct hash_node **old = HASH_TABLE.slots;
+  size_t oldsize = HASH_TABLE.size;
+  HASH_TABLE.size *= 2;
+  HASH_TABLE.slots = hash_alloc_slots(HASH_TABLE.size);
+  size_t mask = HASH_TABLE.size - 1;
+  for (size_t i = 0; i < oldsize; i++) {
+    struct hash_node *node = old[i];
+    if (node == NULL)
+      continue;
+    size_t addr = node->hash & mask;
+    while (HASH_TABLE.slots[addr] != NULL)
+      addr = (addr + 1) & mask;
+    HASH_TABLE.slots[addr] = node;
+  }
+  free(old);
 }
 
 struct hash_node *
-hash_find(char *key)
+hash_find(const char *key, size_t len)
 {
-  struct _hash_node_and_addr node_and_addr;
-  _hash_find(key, &node_and_addr);
-  return node_and_addr.node;
+  return HASH_TABLE.slots[hash_probe(key, len, hash_string(key, len))];
 }
 
 struct hash_node *
-hash_insert(char *key, struct hash_typeinfo typeinfo)
+hash_insert(const char *key, size_t len, struct hash_typeinfo typeinfo)
 {
   // ve se o nodo já está na hash
-  struct _hash_node_and_addr node_and_addr;
-  _hash_find(key, &node_and_addr);
-  if (node_and_addr.node != NULL)
-    return node_and_addr.node;
+  size_t hash = hash_string(key, len);
+  size_t addr = hash_probe(key, len, hash);
+  if (HASH_TABLE.slots[addr] != NULL)
+    return HASH_TABLE.slots[addr];
 
-  // não achamos o nodo, cria e adiciona
-  struct hash_node *ans = malloc(sizeof(*ans));
-  if (!ans)
-    REPORT_AND_EXIT;
-  size_t addr = hash_address(key);
+  // não achamos o nodo, cria e adiciona. A chave vem logo após o nodo.
+  struct hash_node *ans = arena_alloc(&HASH_TABLE.nodes, sizeof(*ans) + len + 1);
   ans->typeinfo = typeinfo;
   ans->astinfo = NULL;
-  ans->key = strdup(key);
-  ans->next = HASH_TABLE[addr];
-  HASH_TABLE[addr] = ans;
+  ans->id = HASH_TABLE.used;
+  memcpy(ans->key, key, len);
+  ans->key[len] = '\0';
+  ans->len = len;
+  ans->hash = hash;
+  ans->opid = 0;
+  HASH_TABLE.slots[addr] = ans;
+  if (HASH_TABLE.used == HASH_TABLE.ordercap) {
+    HASH_TABLE.ordercap = HASH_TABLE.ordercap ? HASH_TABLE.ordercap * 2 : HASH_INIT_SIZE;
+    HASH_TABLE.order = realloc(HASH_TABLE.order, HASH_TABLE.ordercap * sizeof(*HASH_TABLE.order));
+    if (!HASH_TABLE.order)
+      REPORT_AND_EXIT;
+  }
+  HASH_TABLE.order[HASH_TABLE.used] = ans;
+  // mantém o fator de carga <= 1/2
+  if (++HASH_TABLE.used * 2 > HASH_TABLE.size)
+    hash_grow();
   return ans;
 }
 
@@ -97,6 +144,8 @@ hash_nature_to_str(enum hashnature_t nature)
     case hn_var_t: return "var";
     case hn_func_t: return "id";
     case hn_vec_t: return "vec";
+    case hn_tmp_t: return "tmp";
+    case hn_label_t: return "label";
     default: return "unknown";
   }
 }
@@ -126,15 +175,10 @@ hash_print_typeinfo(struct hash_typeinfo typeinfo)
 void
 hash_print(void)
 {
-  struct hash_node *node = NULL;
-  for (size_t i = 0; i < HASH_SIZE; i++) {
-    node = HASH_TABLE[i];
-    printf("address %zu; ", i);
-    while (node != NULL) {
-      printf("key=%s; ", node->key);
-      hash_print_typeinfo(node->typeinfo);
-      node = node->next;
-    }
+  for (size_t i = 0; i < HASH_TABLE.used; i++) {
+    struct hash_node *node = HASH_TABLE.order[i];
+    printf("address %zu; key=%s; ", (size_t)(node->hash & (HASH_TABLE.size - 1)), node->key);
+    hash_print_typeinfo(node->typeinfo);
     printf("\n");
   }
 }
@@ -142,16 +186,14 @@ hash_print(void)
 void
 hash_free(void)
 {
-  for (size_t i = 0; i < HASH_SIZE; i++) {
-    struct hash_node *node = HASH_TABLE[i];
-    while (node != NULL) {
-      struct hash_node *next = node->next;
-      if (node->key != NULL)
-        free(node->key);
-      free(node);
-      node = next;
-    }
-  }
+  arena_free(&HASH_TABLE.nodes);
+  free(HASH_TABLE.slots);
+  free(HASH_TABLE.order);
+  HASH_TABLE.slots = NULL;
+  HASH_TABLE.order = NULL;
+  HASH_TABLE.ordercap = 0;
+  HASH_TABLE.size = 0;
+  HASH_TABLE.used = 0;
 }
 
 void
@@ -165,15 +207,11 @@ int
 hash_fprint_ids(FILE *f, const char *prefix)
 {
   int ans = 0;
-  for (size_t i = 0; i < HASH_SIZE; i++) {
-    struct hash_node *node = HASH_TABLE[i];
-    while (node != NULL) {
-      struct hash_node *next = node->next;
-      if ((node->key != NULL) && (node->typeinfo.nature == hn_id_t)) {
-        fprintf(f, "%s %s\n", prefix, node->key);
-        ans++;
-      }
-      node = next;
+  for (size_t i = 0; i < HASH_TABLE.used; i++) {
+    struct hash_node *node = HASH_TABLE.order[i];
+    if (node->typeinfo.nature == hn_id_t) {
+      fprintf(f, "%s %s\n", prefix, node->key);
+      ans++;
     }
   }
   return ans;
@@ -187,26 +225,53 @@ hash_set_astinfo(struct hash_node *node, struct ast_node *astinfo, const char *c
   node->astinfo = astinfo;
 }
 
+/*
+ * Temporários e labels não entram na tabela: são nodos anônimos numerados,
+ * criados em O(1) sem formatar nem "hashear" uma chave.
+ */
+static struct hash_node *
+hash_create_anon(enum hashnature_t nature, size_t id)
+{
+  struct hash_node *ans = arena_alloc(&HASH_TABLE.nodes, sizeof(*ans) + 1);
+  ans->typeinfo.nature = nature;
+  ans->typeinfo.type = ht_unknown_t;
+  ans->astinfo = NULL;
+  ans->id = id;
+  ans->len = 0;
+  ans->hash = 0;
+  ans->opid = 0;
+  ans->key[0] = '\0';
+  return ans;
+}
+
 struct hash_node *
 hash_create_dummy(void)
 {
-  static int DUMMYCT = 0;
-  char key[9] = "dummyXXX"; // Reminder: \0
-  snprintf(key, 9, "dummy%d", DUMMYCT++ % 999);
-  struct hash_typeinfo typeinfo = { hn_var_t, ht_unknown_t };
-  return hash_insert(strdup(key), typeinfo);
+  return hash_create_anon(hn_tmp_t, DUMMYCT++);
 }
 
 struct hash_node *
 hash_create_label(void)
 {
-  static int LABELCT = 0;
-  char key[9] = "labelXXX"; // Reminder: \0
-  snprintf(key, 9, "label%d", LABELCT++ % 999);
-  struct hash_typeinfo typeinfo = { hn_label_t, ht_unknown_t };
-  return hash_insert(strdup(key), typeinfo);
+  return hash_create_anon(hn_label_t, LABELCT++);
 }
 
+void
+hash_fprint_key(FILE *f, struct hash_node *node)
+{
+  if (node == NULL)
+    return;
+  switch (node->typeinfo.nature) {
+    case hn_tmp_t:
+      fprintf(f, "dummy%zu", node->id);
+      break;
+    case hn_label_t:
+      fprintf(f, "label%zu", node->id);
+      break;
+    default:
+      fprintf(f, "%s", node->key);
+  }
+}
 
 bool
 hash_is_str(struct hash_node *node)
@@ -2,14 +2,19 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
 
-/* Utilize um primo para o tamanho para bom hashing */
-#define HASH_SIZE 997
-struct hash_node *HASH_TABLE[HASH_SIZE];
+/*
+ * Tamanho inicial da tabela. Deve ser potência de 2, o endereço é obtido
+ * mascarando os bits baixos do hash.
+ */
+#define HASH_INIT_SIZE 1024
 
 enum hashnature_t {
   hn_id_t, hn_int_t, hn_float_t, hn_char_t, hn_bool_t, hn_str_t, hn_arg_t,
-  hn_var_t, hn_func_t, hn_vec_t, hn_label_t
+  hn_var_t, hn_func_t, hn_vec_t, hn_label_t, hn_tmp_t
 };
 
 enum hashtype_t {
@@ -27,10 +32,32 @@ struct ast_node;
 struct hash_node {
   struct hash_typeinfo typeinfo;
   struct ast_node *astinfo;
-  char *key;
-  struct hash_node *next;
+  size_t id;   // ordem de inserção, ou número do temporário/label
+  size_t len;  // strlen(key)
+  size_t hash; // hash_string(key, len), guardado para não recalcular
+  uint32_t opid; // índice em tac_prog.ops, 0 enquanto não usado como operando
+  char key[];  // alocada junto ao nodo, na arena da tabela
+};
+
+/*
+ * Tabela com endereçamento aberto (sondagem linear). Cresce (dobra) quando
+ * metade dos slots estiver ocupada, então buscas são O(1) esperado
+ * independente do tamanho da entrada.
+ *
+ * Passagens pela tabela toda devem usar order[0..used), que tem os nodos na
+ * ordem de inserção (order[i]->id == i), sem slots vazios.
+ */
+struct hash_table {
+  struct hash_node **slots;
+  size_t size; // potência de 2
+  size_t used;
+  struct hash_node **order;
+  size_t ordercap;
+  struct arena nodes; // nodos e chaves
 };
 
+extern struct hash_table HASH_TABLE;
+
 bool
 hash_is_str(struct hash_node *node);
 
@@ -47,11 +74,12 @@ void
 hash_set_astinfo(struct hash_node *node, struct ast_node *astinfo, const char *caller, int line);
 
 /*
- * Insere um nodo na tabela com chave key e valor val, retorna o nodo inserido.
- * Caso já exista nodo com essa chave, retorna o existente, sem editar o valor.
+ * Insere um nodo na tabela com chave key (de len bytes, não precisa terminar
+ * em \0) e valor val, retorna o nodo inserido. Caso já exista nodo com essa
+ * chave, retorna o existente, sem editar o valor.
  */
 struct hash_node *
-hash_insert(char *key, struct hash_typeinfo typeinfo);
+hash_insert(const char *key, size_t len, struct hash_typeinfo typeinfo);
 
 /*
  * Inicializa a tabela
@@ -72,10 +100,10 @@ void
 hash_free(void);
 
 /*
- * Retorna um nodo para a chave, nulo se nenhum.
+ * Retorna um nodo para a chave (de len bytes), nulo se nenhum.
  */
 struct hash_node *
-hash_find(char *key);
+hash_find(const char *key, size_t len);
 
 /*
  * Imprime os itens da hash cujo valor é hn_id_t
@@ -84,13 +112,20 @@ int
 hash_fprint_ids(FILE *f, const char *prefix);
 
 /*
- * Retorna um nodo dummy
+ * Retorna um nodo dummy (temporário). Não é inserido na tabela, é identificado
+ * pelo seu id, sequencial a partir de zero, e tem chave vazia.
  */
 struct hash_node *
 hash_create_dummy(void);
 
 /*
- * Retorna um nodo label (dummy)
+ * Retorna um nodo label. Como os dummies, é anônimo e identificado pelo id.
  */
 struct hash_node *
 hash_create_label(void);
+
+/*
+ * Imprime a chave do nodo, ou dummyN/labelN para os anônimos. Para debug.
+ */
+void
+hash_fprint_key(FILE *f, struct hash_node *node);
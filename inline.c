@@ -0,0 +1,315 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "inline.h"
+#include "ast.h"
+#include "hash.h"
+#include "logging.h"
+
+// Tamanho máximo, em instruções, de uma função expandida nas chamadas
+#define INLINE_MAX_INSNS 24
+// Função ainda não expandida, ver inline_expand
+#define INLINE_NONE ((size_t)-1)
+
+static void *
+inline_calloc(size_t n, size_t size)
+{
+  void *ans = calloc(n ? n : 1, size);
+  if (!ans)
+    REPORT_AND_EXIT;
+  return ans;
+}
+
+/*
+ * Corpo de uma função, sem t_fstart_t e t_fend_t
+ */
+struct inline_body {
+  struct tac_insn *insns;
+  size_t n, cap;
+};
+
+struct inline_func {
+  uint32_t op;     // símbolo da função
+  size_t fstart;   // posição do t_fstart_t no programa original
+  size_t fend;     // posição do t_fend_t
+  size_t *callees; // funções chamadas (com repetições)
+  size_t ncallees;
+  bool recursive;  // faz parte de um ciclo no grafo de chamadas
+  size_t size;     // instruções do corpo expandido, INLINE_NONE se não expandido
+  struct inline_body body;
+};
+
+/*
+ * Estado da passagem. map renomeia os operandos da cópia que está sendo
+ * expandida, valendo só onde mapmark[id] == mark.
+ */
+struct inline_state {
+  struct tac_prog *prog;
+  struct inline_func *funcs;
+  size_t nfuncs;
+  size_t *funcof; // por operando, índice da função + 1, 0 se não é função
+  size_t nops;    // operandos no início da passagem (tamanho de funcof)
+  uint32_t *map;
+  size_t *mapmark;
+  size_t mapcap;
+  size_t mark;
+  size_t ans;
+};
+
+static void
+inline_push(struct inline_body *body, enum ttype_t ttype, uint32_t ans, uint32_t op1, uint32_t op2)
+{
+  if (body->n == body->cap) {
+    body->cap = body->cap ? 2 * body->cap : 16;
+    body->insns = realloc(body->insns, body->cap * sizeof(*body->insns));
+    if (!body->insns)
+      REPORT_AND_EXIT;
+  }
+  body->insns[body->n++] = (struct tac_insn){ ttype, ans, op1, op2 };
+}
+
+// Função chamada pela instrução (t_call_t ou t_arg_t), INLINE_NONE se nenhuma
+static size_t
+inline_callee(const struct inline_state *s, const struct tac_insn *insn)
+{
+  if (((insn->ttype != t_call_t) && (insn->ttype != t_arg_t)) || (insn->op1 >= s->nops) ||
+      (s->funcof[insn->op1] == 0))
+    return INLINE_NONE;
+  return s->funcof[insn->op1] - 1;
+}
+
+/*
+ * Acha as funções e as chamadas de cada uma
+ */
+static void
+inline_funcs(struct inline_state *s)
+{
+  const struct tac_prog *prog = s->prog;
+  for (size_t i = 0; i < prog->ninsns; i++)
+    s->nfuncs += (prog->insns[i].ttype == t_fstart_t);
+  s->funcs = inline_calloc(s->nfuncs, sizeof(*s->funcs));
+  s->funcof = inline_calloc(s->nops, sizeof(*s->funcof));
+
+  size_t f = 0;
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    const struct tac_insn *insn = &prog->insns[i];
+    if (insn->ttype == t_fstart_t) {
+      s->funcs[f].op = insn->ans;
+      s->funcs[f].fstart = i;
+      s->funcs[f].size = INLINE_NONE;
+      s->funcof[insn->ans] = f + 1;
+    } else if (insn->ttype == t_fend_t) {
+      s->funcs[f++].fend = i;
+    }
+  }
+
+  for (f = 0; f < s->nfuncs; f++) {
+    struct inline_func *func = &s->funcs[f];
+    for (size_t i = func->fstart + 1; i < func->fend; i++)
+      func->ncallees += (prog->insns[i].ttype == t_call_t);
+    func->callees = inline_calloc(func->ncallees, sizeof(*func->callees));
+    func->ncallees = 0;
+    for (size_t i = func->fstart + 1; i < func->fend; i++) {
+      if (prog->insns[i].ttype == t_call_t)
+        func->callees[func->ncallees++] = inline_callee(s, &prog->insns[i]);
+    }
+  }
+}
+
+/*
+ * Empilha as funções chamadas por g que ainda não foram vistas a partir da
+ * raiz f. Cada função entra no máximo uma vez por raiz, então a pilha não
+ * passa de nfuncs.
+ */
+static void
+inline_push_callees(const struct inline_state *s, size_t f, size_t g, size_t *seen, size_t *stack, size_t *nstack)
+{
+  for (size_t c = 0; c < s->funcs[g].ncallees; c++) {
+    size_t h = s->funcs[g].callees[c];
+    if ((h == INLINE_NONE) || (seen[h] == f + 1))
+      continue;
+    seen[h] = f + 1;
+    stack[(*nstack)++] = h;
+  }
+}
+
+/*
+ * Marca as funções que alcançam a si mesmas no grafo de chamadas, com uma
+ * busca em profundidade a partir de cada uma
+ */
+static void
+inline_recursive(struct inline_state *s)
+{
+  size_t *seen = inline_calloc(s->nfuncs, sizeof(*seen)),
+         *stack = inline_calloc(s->nfuncs, sizeof(*stack)),
+         nstack = 0;
+
+  for (size_t f = 0; f < s->nfuncs; f++) {
+    nstack = 0;
+    inline_push_callees(s, f, f, seen, stack, &nstack);
+    while (nstack > 0) {
+      size_t g = stack[--nstack];
+      if (g == f) {
+        s->funcs[f].recursive = true;
+        break;
+      }
+      inline_push_callees(s, f, g, seen, stack, &nstack);
+    }
+  }
+
+  free(seen);
+  free(stack);
+}
+
+// Nome do operando dentro da cópia, criando um novo para temporários e labels
+static uint32_t
+inline_rename(struct inline_state *s, uint32_t id)
+{
+  if (id == 0)
+    return 0;
+  if (id >= s->mapcap) {
+    size_t cap = s->prog->nops;
+    s->map = realloc(s->map, cap * sizeof(*s->map));
+    s->mapmark = realloc(s->mapmark, cap * sizeof(*s->mapmark));
+    if (!s->map || !s->mapmark)
+      REPORT_AND_EXIT;
+    for (size_t i = s->mapcap; i < cap; i++)
+      s->mapmark[i] = 0;
+    s->mapcap = cap;
+  }
+  if (s->mapmark[id] == s->mark)
+    return s->map[id];
+
+  enum hashnature_t nature = s->prog->ops[id]->typeinfo.nature;
+  if (nature == hn_tmp_t)
+    s->map[id] = tac_prog_op(s->prog, hash_create_dummy());
+  else if (nature == hn_label_t)
+    s->map[id] = tac_prog_op(s->prog, hash_create_label());
+  else
+    s->map[id] = id; // global, literal, função
+  s->mapmark[id] = s->mark;
+  return s->map[id];
+}
+
+/*
+ * Coloca em body a cópia do corpo de g para a chamada cujo resultado vai em
+ * ans, com os argumentos args
+ */
+static void
+inline_splice(struct inline_state *s, struct inline_body *body, size_t g, uint32_t ans,
+              const struct tac_insn *args, size_t nargs)
+{
+  struct tac_prog *prog = s->prog;
+  struct hash_node *func = prog->ops[s->funcs[g].op],
+                   *param = NULL;
+  s->mark++;
+
+  // Parâmetros viram temporários novos, que recebem os argumentos
+  for (size_t k = 0; (param = ast_func_param(func, k)) != NULL; k++) {
+    if (k >= nargs)
+      LOG_AND_EXIT("Argc mismatch %zu for %s\n", nargs, func->key);
+    if (param->opid == 0)
+      continue; // nunca usado
+    inline_rename(s, param->opid); // garante o tamanho de map
+    s->map[param->opid] = tac_prog_op(prog, hash_create_dummy());
+    inline_push(body, t_copy_t, s->map[param->opid], args[k].ans, 0);
+  }
+
+  uint32_t cont = tac_prog_op(prog, hash_create_label());
+  const struct inline_body *src = &s->funcs[g].body;
+  for (size_t i = 0; i < src->n; i++) {
+    const struct tac_insn *insn = &src->insns[i];
+    if (insn->ttype == t_nop_t)
+      continue;
+    if (insn->ttype == t_ret_t) {
+      if (ans != 0)
+        inline_push(body, t_copy_t, ans, inline_rename(s, insn->ans), 0);
+      inline_push(body, t_jmp_t, cont, 0, 0);
+      continue;
+    }
+    inline_push(body, insn->ttype, inline_rename(s, insn->ans), inline_rename(s, insn->op1),
+                inline_rename(s, insn->op2));
+  }
+  inline_push(body, t_label_t, cont, 0, 0);
+  s->ans++;
+}
+
+/*
+ * Monta o corpo de f expandindo as chamadas, depois de expandir as funções
+ * chamadas. Uma função que não faz parte de um ciclo não é alcançável pelas
+ * que ela chama, então a recursão termina.
+ */
+static void
+inline_expand(struct inline_state *s, size_t f)
+{
+  struct inline_func *func = &s->funcs[f];
+  if (func->size != INLINE_NONE)
+    return;
+  const struct tac_insn *insns = s->prog->insns;
+
+  for (size_t i = func->fstart + 1; i < func->fend; i++) {
+    // Argumentos vêm em sequência, logo antes da chamada
+    size_t call = i;
+    while ((call < func->fend) && (insns[call].ttype == t_arg_t))
+      call++;
+    size_t g = inline_callee(s, &insns[call]);
+    if ((insns[call].ttype != t_call_t) || (g == INLINE_NONE) || (g == f) || s->funcs[g].recursive) {
+      inline_push(&func->body, insns[i].ttype, insns[i].ans, insns[i].op1, insns[i].op2);
+      continue;
+    }
+    inline_expand(s, g);
+    if (s->funcs[g].size > INLINE_MAX_INSNS) {
+      inline_push(&func->body, insns[i].ttype, insns[i].ans, insns[i].op1, insns[i].op2);
+      continue;
+    }
+    inline_splice(s, &func->body, g, insns[call].ans, &insns[i], call - i);
+    i = call;
+  }
+
+  func->size = 0;
+  for (size_t i = 0; i < func->body.n; i++)
+    func->size += (func->body.insns[i].ttype != t_nop_t);
+}
+
+size_t
+inline_calls(struct tac_prog *prog)
+{
+  struct inline_state s = { prog, NULL, 0, NULL, prog->nops, NULL, NULL, 0, 0, 0 };
+  inline_funcs(&s);
+  inline_recursive(&s);
+  for (size_t f = 0; f < s.nfuncs; f++)
+    inline_expand(&s, f);
+
+  if (s.ans > 0) {
+    // Monta o programa de novo, com os corpos expandidos no lugar das funções
+    struct tac_insn *old = prog->insns;
+    size_t nold = prog->ninsns,
+           f = 0;
+    prog->insns = NULL;
+    prog->ninsns = prog->insncap = 0;
+    for (size_t i = 0; i < nold; i++) {
+      if (old[i].ttype != t_fstart_t) {
+        tac_prog_push(prog, old[i].ttype, old[i].ans, old[i].op1, old[i].op2);
+        continue;
+      }
+      const struct inline_func *func = &s.funcs[f++];
+      tac_prog_push(prog, old[i].ttype, old[i].ans, old[i].op1, old[i].op2);
+      for (size_t b = 0; b < func->body.n; b++) {
+        const struct tac_insn *insn = &func->body.insns[b];
+        tac_prog_push(prog, insn->ttype, insn->ans, insn->op1, insn->op2);
+      }
+      i = func->fend;
+      tac_prog_push(prog, old[i].ttype, old[i].ans, old[i].op1, old[i].op2);
+    }
+    free(old);
+  }
+
+  for (size_t f = 0; f < s.nfuncs; f++) {
+    free(s.funcs[f].callees);
+    free(s.funcs[f].body.insns);
+  }
+  free(s.funcs);
+  free(s.funcof);
+  free(s.map);
+  free(s.mapmark);
+  return s.ans;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "tac.h"
+
+/*
+ * Expansão de chamadas (inlining): chamadas a funções pequenas (até
+ * INLINE_MAX_INSNS instruções, depois de expandidas as chamadas delas) e que
+ * não fazem parte de um ciclo no grafo de chamadas são trocadas pelo corpo da
+ * função. Parâmetros, temporários e labels da cópia são renomeados, os
+ * argumentos viram cópias para os parâmetros e cada t_ret_t vira uma cópia
+ * para o resultado da chamada seguida de um desvio para depois do corpo.
+ * Retorna quantas chamadas foram expandidas.
+ */
+size_t
+inline_calls(struct tac_prog *prog);
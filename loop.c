@@ -0,0 +1,623 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "loop.h"
+#include "cfg.h"
+#include "hash.h"
+#include "logging.h"
+
+static void *
+loop_calloc(size_t n, size_t size)
+{
+  void *ans = calloc(n ? n : 1, size);
+  if (!ans)
+    REPORT_AND_EXIT;
+  return ans;
+}
+
+/*
+ * Se dá para inserir instruções antes do label do cabeçalho de forma que
+ * executem uma vez só: o laço só é alcançado pelo bloco anterior, sem desvio
+ * (o label fica, e os desvios de volta para ele pulam o que foi inserido)
+ */
+static bool
+loop_has_preheader(const struct cfg *cfg, const struct tac_prog *prog, const struct cfg_loop *loop)
+{
+  const struct cfg_block *header = &cfg->blocks[loop->header];
+  if ((loop->header == cfg->funcs[header->func].first) ||
+      (prog->insns[header->first].ttype != t_label_t))
+    return false;
+
+  for (size_t p = 0; p < header->npred; p++) {
+    size_t pred = cfg->preds[header->pred + p];
+    if (cfg_dominates(cfg, loop->header, pred))
+      continue; // aresta de retorno
+    if (pred != loop->header - 1)
+      return false;
+    const struct tac_insn *last = &prog->insns[cfg->blocks[pred].end - 1];
+    if ((last->ttype == t_jmp_t) || (last->ttype == t_jmpf_t))
+      return false;
+  }
+
+  return true;
+}
+
+/*
+ * Estado de loop_licm. Os arrays por operando usam o número do laço + 1 como
+ * marca, para não precisar limpá-los a cada laço.
+ */
+struct loop_licm {
+  struct tac_prog *prog;
+  struct cfg cfg;
+  size_t *ndefs;   // definições de cada operando no programa
+  size_t *defpos;  // posição da (última) definição
+  size_t *loopdef; // marca se o operando é escrito dentro do laço
+  size_t *vecdef;  // marca se o vetor é escrito dentro do laço
+  size_t *dest;    // para cada instrução, antes de qual ela vai, ou CFG_NONE
+};
+
+static bool
+loop_invariant_op(const struct loop_licm *l, uint32_t id, size_t mark, bool clobber)
+{
+  int32_t val = 0;
+  if ((id == 0) || tac_prog_const_value(l->prog, id, &val))
+    return true;
+  if (l->loopdef[id] != mark)
+    // Definido fora: variáveis podem ser escritas pelas chamadas no laço
+    return (l->prog->ops[id]->typeinfo.nature == hn_tmp_t) || !clobber;
+  // Definido dentro, por uma instrução que já sai do laço
+  return (l->ndefs[id] == 1) && (l->dest[l->defpos[id]] != CFG_NONE);
+}
+
+static bool
+loop_can_hoist(const struct loop_licm *l, const struct tac_insn *insn, size_t mark, bool clobber)
+{
+  switch (insn->ttype) {
+    case t_add_t:
+    case t_sub_t:
+    case t_mul_t:
+    case t_lt_t:
+    case t_gt_t:
+    case t_le_t:
+    case t_ge_t:
+    case t_eq_t:
+    case t_ne_t:
+    case t_or_t:
+    case t_and_t:
+    case t_pow_t:
+      break;
+    case t_vread_t:
+      if (clobber || (l->vecdef[insn->op1] == mark))
+        return false;
+      break;
+    default:
+      return false;
+  }
+
+  // O índice de t_vread_t (op2) também precisa ser invariante
+  return (l->prog->ops[insn->ans]->typeinfo.nature == hn_tmp_t) && (l->ndefs[insn->ans] == 1) &&
+         loop_invariant_op(l, insn->op1, mark, clobber) && loop_invariant_op(l, insn->op2, mark, clobber);
+}
+
+/*
+ * Marca as instruções invariantes do laço para irem antes do cabeçalho.
+ * Repete até estabilizar, já que uma instrução pode depender de outra que
+ * vem depois dela no corpo.
+ */
+static size_t
+loop_licm_loop(struct loop_licm *l, size_t loopi)
+{
+  const struct cfg_loop *loop = &l->cfg.loops[loopi];
+  struct tac_prog *prog = l->prog;
+  size_t mark = loopi + 1,
+         ans = 0;
+  bool clobber = false;
+
+  for (size_t b = 0; b < loop->nbody; b++) {
+    const struct cfg_block *block = &l->cfg.blocks[l->cfg.loopblocks[loop->body + b]];
+    for (size_t i = block->first; i < block->end; i++) {
+      const struct tac_insn *insn = &prog->insns[i];
+      if (l->dest[i] != CFG_NONE)
+        continue; // já sai de um laço externo
+      l->loopdef[tac_insn_def(insn)] = mark;
+      if (insn->ttype == t_vcopy_t)
+        l->vecdef[insn->ans] = mark;
+      else if ((insn->ttype == t_call_t) || (insn->ttype == t_arg_t))
+        clobber = true; // a função chamada pode escrever em qualquer global
+    }
+  }
+
+  size_t pos = l->cfg.blocks[loop->header].first;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t b = 0; b < loop->nbody; b++) {
+      const struct cfg_block *block = &l->cfg.blocks[l->cfg.loopblocks[loop->body + b]];
+      for (size_t i = block->first; i < block->end; i++) {
+        if ((l->dest[i] == CFG_NONE) && loop_can_hoist(l, &prog->insns[i], mark, clobber)) {
+          l->dest[i] = pos;
+          changed = true;
+          ans++;
+        }
+      }
+    }
+  }
+
+  return ans;
+}
+
+/*
+ * Instruções a inserir no programa, cada uma antes da posição pos (do
+ * programa original). Inserções na mesma posição ficam na ordem em que foram
+ * pedidas.
+ */
+struct loop_edits {
+  struct loop_insert {
+    size_t pos;
+    struct tac_insn insn;
+  } *ins;
+  size_t n, cap;
+};
+
+static void
+loop_insert(struct loop_edits *e, size_t pos, enum ttype_t ttype, uint32_t ans, uint32_t op1, uint32_t op2)
+{
+  if (e->n == e->cap) {
+    e->cap = e->cap ? 2 * e->cap : 16;
+    e->ins = realloc(e->ins, e->cap * sizeof(*e->ins));
+    if (!e->ins)
+      REPORT_AND_EXIT;
+  }
+  struct loop_insert *in = &e->ins[e->n++];
+  in->pos = pos;
+  in->insn.ttype = ttype;
+  in->insn.ans = ans;
+  in->insn.op1 = op1;
+  in->insn.op2 = op2;
+}
+
+/*
+ * Reescreve o programa com as inserções, removendo os t_nop_t, e libera as
+ * inserções
+ */
+static void
+loop_apply(struct tac_prog *prog, struct loop_edits *e)
+{
+  size_t n = prog->ninsns;
+  size_t *start = loop_calloc(n + 2, sizeof(*start)),
+         *order = loop_calloc(e->n, sizeof(*order));
+  struct tac_insn *insns = loop_calloc(n + e->n, sizeof(*insns));
+
+  // Ordena as inserções por posição, estável: no fim, as da posição i ficam
+  // em order[start[i], start[i + 1])
+  for (size_t k = 0; k < e->n; k++)
+    start[e->ins[k].pos + 2]++;
+  for (size_t i = 0; i < n; i++)
+    start[i + 2] += start[i + 1];
+  for (size_t k = 0; k < e->n; k++)
+    order[start[e->ins[k].pos + 1]++] = k;
+
+  size_t j = 0;
+  for (size_t i = 0; i <= n; i++) {
+    for (size_t k = start[i]; k < start[i + 1]; k++)
+      insns[j++] = e->ins[order[k]].insn;
+    if ((i < n) && (prog->insns[i].ttype != t_nop_t))
+      insns[j++] = prog->insns[i];
+  }
+
+  free(prog->insns);
+  prog->insns = insns;
+  prog->ninsns = j;
+  prog->insncap = n + e->n;
+  free(start);
+  free(order);
+  free(e->ins);
+  e->ins = NULL;
+  e->n = e->cap = 0;
+}
+
+size_t
+loop_licm(struct tac_prog *prog)
+{
+  struct loop_licm l;
+  size_t ans = 0;
+
+  l.prog = prog;
+  l.cfg = cfg_build(prog);
+  if (l.cfg.nloops == 0) {
+    cfg_free(&l.cfg);
+    return 0;
+  }
+  l.ndefs = loop_calloc(prog->nops, sizeof(*l.ndefs));
+  l.defpos = loop_calloc(prog->nops, sizeof(*l.defpos));
+  l.loopdef = loop_calloc(prog->nops, sizeof(*l.loopdef));
+  l.vecdef = loop_calloc(prog->nops, sizeof(*l.vecdef));
+  l.dest = loop_calloc(prog->ninsns, sizeof(*l.dest));
+
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    uint32_t def = tac_insn_def(&prog->insns[i]);
+    l.ndefs[def]++;
+    l.defpos[def] = i;
+    l.dest[i] = CFG_NONE;
+  }
+
+  // Externos primeiro: o que é invariante no laço externo sai dos dois
+  for (size_t i = 0; i < l.cfg.nloops; i++) {
+    if (loop_has_preheader(&l.cfg, prog, &l.cfg.loops[i]))
+      ans += loop_licm_loop(&l, i);
+  }
+
+  if (ans > 0) {
+    struct loop_edits e = { NULL, 0, 0 };
+    for (size_t i = 0; i < prog->ninsns; i++) {
+      struct tac_insn *insn = &prog->insns[i];
+      if (l.dest[i] != CFG_NONE) {
+        loop_insert(&e, l.dest[i], insn->ttype, insn->ans, insn->op1, insn->op2);
+        insn->ttype = t_nop_t;
+      }
+    }
+    loop_apply(prog, &e);
+  }
+
+  cfg_free(&l.cfg);
+  free(l.ndefs);
+  free(l.defpos);
+  free(l.loopdef);
+  free(l.vecdef);
+  free(l.dest);
+  return ans;
+}
+
+// Máximo de variáveis de indução e de multiplicações reduzidas por laço
+#define LOOP_MAX_IVS 8
+#define LOOP_MAX_REDUCED 16
+
+/*
+ * Variável de indução básica: escrita uma única vez no laço, por
+ * add var, var, step na posição pos
+ */
+struct loop_iv {
+  uint32_t var;
+  int32_t step;
+  size_t pos;
+  size_t nreduced; // multiplicações por constante trocadas por r
+};
+
+/*
+ * Estado de loop_ivs. As contagens dentro do laço valem para o operando id
+ * se mark[id] é o número do laço + 1.
+ */
+struct loop_ivs {
+  struct tac_prog *prog;
+  struct cfg cfg;
+  size_t nops;
+  size_t *nuses;    // usos de cada operando no programa
+  size_t *mark;
+  size_t *loopdefs; // definições dentro do laço
+  size_t *loopuses; // usos dentro do laço
+  bool *done;       // blocos de laços já transformados nesta passagem
+  struct loop_edits e;
+};
+
+static void
+loop_ivs_count(struct loop_ivs *l, uint32_t id, size_t mark, bool def)
+{
+  if (id >= l->nops)
+    return;
+  if (l->mark[id] != mark) {
+    l->mark[id] = mark;
+    l->loopdefs[id] = l->loopuses[id] = 0;
+  }
+  if (def)
+    l->loopdefs[id]++;
+  else
+    l->loopuses[id]++;
+}
+
+static size_t
+loop_ivs_defs(const struct loop_ivs *l, uint32_t id, size_t mark)
+{
+  return ((id < l->nops) && (l->mark[id] == mark)) ? l->loopdefs[id] : 0;
+}
+
+static uint32_t
+loop_ivs_dummy(struct tac_prog *prog)
+{
+  return tac_prog_op(prog, hash_create_dummy());
+}
+
+/*
+ * Troca mul t, i, k (k constante, i variável de indução) por copy t, r, com
+ * r = i * k calculado antes do laço e somado de step * k logo depois de cada
+ * incremento de i
+ */
+static size_t
+loop_ivs_reduce(struct loop_ivs *l, const struct cfg_loop *loop, struct loop_iv *ivs, size_t nivs)
+{
+  struct tac_prog *prog = l->prog;
+  struct {
+    size_t iv;
+    int32_t k;
+    uint32_t r;
+  } red[LOOP_MAX_REDUCED];
+  size_t nred = 0,
+         ans = 0;
+
+  for (size_t b = 0; b < loop->nbody; b++) {
+    const struct cfg_block *block = &l->cfg.blocks[l->cfg.loopblocks[loop->body + b]];
+    for (size_t i = block->first; i < block->end; i++) {
+      struct tac_insn *insn = &prog->insns[i];
+      if (insn->ttype != t_mul_t)
+        continue;
+
+      size_t iv = nivs;
+      int32_t k = 0;
+      uint32_t kop = 0;
+      for (size_t v = 0; (v < nivs) && (iv == nivs); v++) {
+        if ((insn->op1 == ivs[v].var) && tac_prog_const_value(prog, insn->op2, &k)) {
+          iv = v;
+          kop = insn->op2;
+        } else if ((insn->op2 == ivs[v].var) && tac_prog_const_value(prog, insn->op1, &k)) {
+          iv = v;
+          kop = insn->op1;
+        }
+      }
+      if (iv == nivs)
+        continue;
+
+      size_t r = 0;
+      while ((r < nred) && ((red[r].iv != iv) || (red[r].k != k)))
+        r++;
+      if (r == nred) {
+        if (nred == LOOP_MAX_REDUCED)
+          continue;
+        red[r].iv = iv;
+        red[r].k = k;
+        red[r].r = loop_ivs_dummy(prog);
+        int32_t step = (int32_t)(uint32_t)((int64_t)ivs[iv].step * k);
+        loop_insert(&l->e, l->cfg.blocks[loop->header].first, t_mul_t, red[r].r, ivs[iv].var, kop);
+        loop_insert(&l->e, ivs[iv].pos + 1, t_add_t, red[r].r, red[r].r, tac_prog_const(prog, step));
+        nred++;
+      }
+
+      insn->ttype = t_copy_t;
+      insn->op1 = red[r].r;
+      insn->op2 = 0;
+      ivs[iv].nreduced++;
+      ans++;
+    }
+  }
+
+  return ans;
+}
+
+// Se o bloco b pertence ao laço loopi ou a um laço dentro dele
+static bool
+loop_contains(const struct cfg *cfg, size_t loopi, size_t b)
+{
+  for (size_t in = cfg->blocks[b].loop; in != CFG_NONE; in = cfg->loops[in].parent) {
+    if (in == loopi)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Saídas do laço além do teste do cabeçalho: retornos no corpo (ret) e
+ * desvios ou passagens para blocos fora dele (jump)
+ */
+static void
+loop_exits(const struct cfg *cfg, const struct tac_prog *prog, const struct cfg_loop *loop, bool *ret, bool *jump)
+{
+  size_t loopi = (size_t)(loop - cfg->loops);
+  for (size_t b = 0; b < loop->nbody; b++) {
+    size_t block = cfg->loopblocks[loop->body + b];
+    if (prog->insns[cfg->blocks[block].end - 1].ttype == t_ret_t)
+      *ret = true;
+    if (block == loop->header)
+      continue;
+    for (unsigned int s = 0; s < cfg->blocks[block].nsucc; s++) {
+      if (!loop_contains(cfg, loopi, cfg->blocks[block].succ[s]))
+        *jump = true;
+    }
+  }
+}
+
+/*
+ * Laço contado: cabeçalho só com lt t, i, end e jmpf, i com valor inicial,
+ * fim e passo constantes e um único desvio de volta, no fim do corpo. Vira
+ * cnt = número de iterações antes do laço, sem teste no cabeçalho, e
+ * cnt = cnt - 1; se cnt != 0 volta, no lugar do jmp. Se i só é usado pelo
+ * próprio laço e o fim é a única saída em que ele ainda é visível, seu
+ * incremento sai e ele recebe o valor final na saída.
+ */
+static size_t
+loop_ivs_counted(struct loop_ivs *l, const struct cfg_loop *loop, const struct loop_iv *ivs, size_t nivs)
+{
+  struct tac_prog *prog = l->prog;
+  const struct cfg_block *header = &l->cfg.blocks[loop->header];
+  if (header->end - header->first != 3)
+    return 0;
+  struct tac_insn *lt = &prog->insns[header->first + 1],
+                  *jmpf = &prog->insns[header->first + 2];
+  int32_t end = 0;
+  if ((lt->ttype != t_lt_t) || (jmpf->ttype != t_jmpf_t) || (jmpf->op1 != lt->ans) ||
+      (l->nuses[lt->ans] != 1) || !tac_prog_const_value(prog, lt->op2, &end))
+    return 0;
+
+  size_t iv = 0;
+  while ((iv < nivs) && (ivs[iv].var != lt->op1))
+    iv++;
+  if ((iv == nivs) || (ivs[iv].step <= 0))
+    return 0;
+
+  size_t latch = CFG_NONE;
+  for (size_t p = 0; p < header->npred; p++) {
+    size_t pred = l->cfg.preds[header->pred + p];
+    if (!cfg_dominates(&l->cfg, loop->header, pred))
+      continue;
+    if (latch != CFG_NONE)
+      return 0;
+    latch = pred;
+  }
+  // O incremento tem que acontecer exatamente uma vez por iteração
+  size_t incblock = l->cfg.insnblock[ivs[iv].pos];
+  if ((latch == CFG_NONE) || (l->cfg.blocks[incblock].loop != (size_t)(loop - l->cfg.loops)) ||
+      !cfg_dominates(&l->cfg, incblock, latch))
+    return 0;
+  size_t jmppos = l->cfg.blocks[latch].end - 1,
+         exit = l->cfg.labelblock[jmpf->ans];
+  struct tac_insn *jmp = &prog->insns[jmppos];
+  if ((jmp->ttype != t_jmp_t) || (jmp->ans != prog->insns[header->first].ans) ||
+      (l->cfg.blocks[exit].first != jmppos + 1) || (l->cfg.blocks[exit].npred != 1))
+    return 0;
+
+  // Valor inicial: última escrita em i antes do cabeçalho
+  const struct cfg_block *pre = &l->cfg.blocks[loop->header - 1];
+  int32_t ini = 0;
+  bool found = false;
+  for (size_t i = header->first; !found && (i-- > pre->first);) {
+    const struct tac_insn *insn = &prog->insns[i];
+    if ((insn->ttype == t_call_t) || (insn->ttype == t_arg_t))
+      return 0;
+    if (tac_insn_def(insn) == ivs[iv].var) {
+      if ((insn->ttype != t_copy_t) || !tac_prog_const_value(prog, insn->op1, &ini))
+        return 0;
+      found = true;
+    }
+  }
+  if (!found || (ini >= end))
+    return 0;
+
+  int64_t n = ((int64_t)end - ini + ivs[iv].step - 1) / ivs[iv].step,
+          last = ini + n * ivs[iv].step;
+  if (last > INT32_MAX)
+    return 0; // o laço original dá a volta
+  uint32_t cnt = loop_ivs_dummy(prog),
+           t = loop_ivs_dummy(prog);
+
+  loop_insert(&l->e, header->first, t_copy_t, cnt, tac_prog_const(prog, (int32_t)n), 0);
+  lt->ttype = t_nop_t;
+  jmpf->ttype = t_nop_t;
+  loop_insert(&l->e, jmppos, t_sub_t, cnt, cnt, tac_prog_const(prog, 1));
+  loop_insert(&l->e, jmppos, t_eq_t, t, cnt, tac_prog_const(prog, 0));
+  jmp->ttype = t_jmpf_t;
+  jmp->op1 = t;
+
+  // Usos de i no laço: o incremento, o teste e as multiplicações reduzidas.
+  // O valor final só é escrito na saída pelo fim, então outras saídas
+  // precisam de i em dia, exceto retornos quando i é local à função.
+  bool ret = false,
+       jump = false;
+  loop_exits(&l->cfg, prog, loop, &ret, &jump);
+  enum hashnature_t nature = prog->ops[ivs[iv].var]->typeinfo.nature;
+  bool local = (nature == hn_tmp_t) || (nature == hn_arg_t);
+  if ((l->loopuses[ivs[iv].var] == 2 + ivs[iv].nreduced) && !jump && (!ret || local)) {
+    prog->insns[ivs[iv].pos].ttype = t_nop_t;
+    loop_insert(&l->e, jmppos + 1, t_copy_t, ivs[iv].var, tac_prog_const(prog, (int32_t)last), 0);
+  }
+  return 1;
+}
+
+static size_t
+loop_ivs_loop(struct loop_ivs *l, size_t loopi)
+{
+  const struct cfg_loop *loop = &l->cfg.loops[loopi];
+  struct tac_prog *prog = l->prog;
+  size_t mark = loopi + 1;
+
+  if (!loop_has_preheader(&l->cfg, prog, loop))
+    return 0;
+  for (size_t b = 0; b < loop->nbody; b++) {
+    size_t block = l->cfg.loopblocks[loop->body + b];
+    if (l->done[block])
+      return 0; // contém um laço já transformado, fica para a próxima passagem
+  }
+
+  for (size_t b = 0; b < loop->nbody; b++) {
+    const struct cfg_block *block = &l->cfg.blocks[l->cfg.loopblocks[loop->body + b]];
+    for (size_t i = block->first; i < block->end; i++) {
+      struct tac_insn *insn = &prog->insns[i];
+      // Chamadas podem ler e escrever as variáveis do laço
+      if ((insn->ttype == t_call_t) || (insn->ttype == t_arg_t))
+        return 0;
+      loop_ivs_count(l, tac_insn_def(insn), mark, true);
+      uint32_t *uses[TAC_MAX_USES];
+      unsigned int n = tac_insn_uses(insn, uses);
+      for (unsigned int u = 0; u < n; u++)
+        loop_ivs_count(l, *uses[u], mark, false);
+    }
+  }
+
+  struct loop_iv ivs[LOOP_MAX_IVS];
+  size_t nivs = 0;
+  for (size_t b = 0; (b < loop->nbody) && (nivs < LOOP_MAX_IVS); b++) {
+    const struct cfg_block *block = &l->cfg.blocks[l->cfg.loopblocks[loop->body + b]];
+    for (size_t i = block->first; (i < block->end) && (nivs < LOOP_MAX_IVS); i++) {
+      const struct tac_insn *insn = &prog->insns[i];
+      int32_t step = 0;
+      if ((insn->ttype != t_add_t) || (loop_ivs_defs(l, insn->ans, mark) != 1))
+        continue;
+      if (((insn->op1 == insn->ans) && tac_prog_const_value(prog, insn->op2, &step)) ||
+          ((insn->op2 == insn->ans) && tac_prog_const_value(prog, insn->op1, &step))) {
+        ivs[nivs].var = insn->ans;
+        ivs[nivs].step = step;
+        ivs[nivs].pos = i;
+        ivs[nivs].nreduced = 0;
+        nivs++;
+      }
+    }
+  }
+  if (nivs == 0)
+    return 0;
+
+  size_t ans = loop_ivs_reduce(l, loop, ivs, nivs) + loop_ivs_counted(l, loop, ivs, nivs);
+  if (ans > 0) {
+    for (size_t b = 0; b < loop->nbody; b++)
+      l->done[l->cfg.loopblocks[loop->body + b]] = true;
+  }
+  return ans;
+}
+
+size_t
+loop_ivs(struct tac_prog *prog)
+{
+  struct loop_ivs l;
+  size_t ans = 0;
+
+  l.prog = prog;
+  l.cfg = cfg_build(prog);
+  if (l.cfg.nloops == 0) {
+    cfg_free(&l.cfg);
+    return 0;
+  }
+  l.nops = prog->nops;
+  l.nuses = loop_calloc(l.nops, sizeof(*l.nuses));
+  l.mark = loop_calloc(l.nops, sizeof(*l.mark));
+  l.loopdefs = loop_calloc(l.nops, sizeof(*l.loopdefs));
+  l.loopuses = loop_calloc(l.nops, sizeof(*l.loopuses));
+  l.done = loop_calloc(l.cfg.nblocks, sizeof(*l.done));
+  l.e.ins = NULL;
+  l.e.n = l.e.cap = 0;
+
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    uint32_t *uses[TAC_MAX_USES];
+    unsigned int n = tac_insn_uses(&prog->insns[i], uses);
+    for (unsigned int u = 0; u < n; u++)
+      l.nuses[*uses[u]]++;
+  }
+
+  // Internos primeiro; um externo que contém um laço transformado espera
+  for (size_t i = l.cfg.nloops; i-- > 0;)
+    ans += loop_ivs_loop(&l, i);
+
+  if (ans > 0)
+    loop_apply(prog, &l.e);
+
+  cfg_free(&l.cfg);
+  free(l.nuses);
+  free(l.mark);
+  free(l.loopdefs);
+  free(l.loopuses);
+  free(l.done);
+  return ans;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "tac.h"
+
+/*
+ * Move para antes do laço (um preheader, logo antes do label do cabeçalho) as
+ * instruções cujo resultado não muda entre iterações: operandos constantes ou
+ * definidos fora do laço, levando em conta cópias, escritas em vetores,
+ * chamadas e read dentro dele. Só temporários de definição única são movidos,
+ * e nunca divisões, que poderiam falhar num laço que não executaria. Retorna
+ * quantas instruções foram movidas.
+ */
+size_t
+loop_licm(struct tac_prog *prog);
+
+/*
+ * Variáveis de indução (escritas no laço só por i = i + constante):
+ * multiplicações i * k por constante viram somas de uma nova variável, e
+ * laços com número de iterações conhecido contam até zero, com um único teste
+ * no fim do corpo. Laços com chamadas ficam como estão. Retorna quantas
+ * instruções ou laços mudaram.
+ */
+size_t
+loop_ivs(struct tac_prog *prog);
@@ -7,6 +7,7 @@
 #include "logging.h"
 #include "asm.h"
 #include "tac.h"
+#include "opt.h"
 #include "ast.h"
 #include "hash.h"
 #include "errors.h"
@@ -55,11 +56,13 @@ main(int argc, char **argv)
       ans = E_SEMANTIC;
     }
     // Etapa 5
-    struct tac_node *tactail = tac_gencode(AST_HEAD);
-    //tac_print(tac_get_head(tactail));
+    struct tac_prog prog = tac_prog_from_frag(tac_gencode(AST_HEAD));
+    opt_run(&prog);
+    //tac_prog_print(&prog);
     // Etapa 6
-    asm_print(out, tac_get_head(tactail), HASH_TABLE, HASH_SIZE);
-    // TODO ast free
+    asm_print(out, &prog, HASH_TABLE.order, HASH_TABLE.used);
+    tac_prog_free(&prog);
+    ast_free();
   } else {
     fprintf(stderr, "bison parsing error=%d\n", ans);
     ans = E_SYNTAX;
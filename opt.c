@@ -0,0 +1,875 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "opt.h"
+#include "cfg.h"
+#include "loop.h"
+#include "inline.h"
+#include "hash.h"
+#include "logging.h"
+
+// Fato válido em todo o programa, ver struct opt_consts
+#define OPT_ALWAYS ((size_t)-1)
+// Máximo de iterações de opt_run
+#define OPT_MAX_ROUNDS 8
+// Distância máxima entre definição e cópia coalescidas, ver opt_copies
+#define OPT_MAX_COALESCE 32
+
+static void *
+opt_calloc(size_t n, size_t size)
+{
+  void *ans = calloc(n ? n : 1, size);
+  if (!ans)
+    REPORT_AND_EXIT;
+  return ans;
+}
+
+/*
+ * Valores conhecidos dos operandos. O fato sobre o operando id vale se
+ * stamp[id] == epoch (até o fim do bloco ou a próxima chamada) ou OPT_ALWAYS
+ * (temporário definido uma vez só). Operandos criados durante a passagem
+ * (id >= n) são sempre constantes.
+ */
+struct opt_consts {
+  struct tac_prog *prog;
+  size_t n;
+  int32_t *val;
+  size_t *stamp;
+  size_t *ndefs;
+  size_t epoch;
+};
+
+static bool
+opt_known(const struct opt_consts *c, uint32_t id, int32_t *val)
+{
+  if (id == 0)
+    return false;
+  if (tac_prog_const_value(c->prog, id, val))
+    return true;
+  if ((id >= c->n) || ((c->stamp[id] != c->epoch) && (c->stamp[id] != OPT_ALWAYS)))
+    return false;
+  *val = c->val[id];
+  return true;
+}
+
+// Aritmética de 32 bits com wraparound, como as instruções emitidas
+static int32_t
+opt_wrap(int64_t val)
+{
+  return (int32_t)(uint32_t)(uint64_t)val;
+}
+
+/*
+ * a ^ b por quadrado e multiplicação, com o expoente sem sinal (32 bits), como
+ * o código emitido pelo backend
+ */
+static int32_t
+opt_pow(int32_t a, int32_t b)
+{
+  uint32_t base = (uint32_t)a,
+           exp = (uint32_t)b,
+           ans = 1;
+  for (; exp != 0; exp >>= 1) {
+    if (exp & 1)
+      ans *= base;
+    base *= base;
+  }
+  return (int32_t)ans;
+}
+
+/*
+ * Calcula a ttype b em ans. Falha para o que não sabemos dobrar e para
+ * divisões que falhariam em tempo de execução (por zero, INT32_MIN / -1),
+ * que são mantidas como estão.
+ */
+static bool
+opt_eval(enum ttype_t ttype, int32_t a, int32_t b, int32_t *ans)
+{
+  switch (ttype) {
+    case t_add_t:
+      *ans = opt_wrap((int64_t)a + b);
+      return true;
+    case t_sub_t:
+      *ans = opt_wrap((int64_t)a - b);
+      return true;
+    case t_mul_t:
+      *ans = opt_wrap((int64_t)a * b);
+      return true;
+    case t_div_t:
+      if ((b == 0) || ((a == INT32_MIN) && (b == -1)))
+        return false;
+      *ans = a / b;
+      return true;
+    case t_pow_t:
+      *ans = opt_pow(a, b);
+      return true;
+    case t_lt_t:
+      *ans = a < b;
+      return true;
+    case t_gt_t:
+      *ans = a > b;
+      return true;
+    case t_le_t:
+      *ans = a <= b;
+      return true;
+    case t_ge_t:
+      *ans = a >= b;
+      return true;
+    case t_eq_t:
+      *ans = a == b;
+      return true;
+    case t_ne_t:
+      *ans = a != b;
+      return true;
+    case t_or_t:
+      *ans = (a != 0) || (b != 0);
+      return true;
+    case t_and_t:
+      *ans = (a != 0) && (b != 0);
+      return true;
+    default:
+      return false;
+  }
+}
+
+static void
+opt_make_copy(struct tac_insn *insn, uint32_t op)
+{
+  insn->ttype = t_copy_t;
+  insn->op1 = op;
+  insn->op2 = 0;
+}
+
+/*
+ * Identidades com um só operando constante: x + 0, x - 0, x * 1, x / 1, x ^ 1
+ * e x * 0, x & 0, x | c (c != 0), x ^ 0, 1 ^ x. Retorna true se a instrução
+ * virou cópia.
+ */
+static bool
+opt_simplify(struct tac_prog *prog, struct tac_insn *insn, bool k1, int32_t v1, bool k2, int32_t v2)
+{
+  uint32_t op = 0;
+
+  switch (insn->ttype) {
+    case t_add_t:
+      if (k1 && (v1 == 0))
+        op = insn->op2;
+      else if (k2 && (v2 == 0))
+        op = insn->op1;
+      break;
+    case t_sub_t:
+      if (k2 && (v2 == 0))
+        op = insn->op1;
+      break;
+    case t_mul_t:
+      if ((k1 && (v1 == 0)) || (k2 && (v2 == 0)))
+        op = tac_prog_const(prog, 0);
+      else if (k1 && (v1 == 1))
+        op = insn->op2;
+      else if (k2 && (v2 == 1))
+        op = insn->op1;
+      break;
+    case t_div_t:
+      if (k2 && (v2 == 1))
+        op = insn->op1;
+      break;
+    case t_pow_t:
+      if ((k2 && (v2 == 0)) || (k1 && (v1 == 1)))
+        op = tac_prog_const(prog, 1);
+      else if (k2 && (v2 == 1))
+        op = insn->op1;
+      break;
+    case t_and_t:
+      if ((k1 && (v1 == 0)) || (k2 && (v2 == 0)))
+        op = tac_prog_const(prog, 0);
+      break;
+    case t_or_t:
+      if ((k1 && (v1 != 0)) || (k2 && (v2 != 0)))
+        op = tac_prog_const(prog, 1);
+      break;
+    default:
+      break;
+  }
+
+  if (op == 0)
+    return false;
+  opt_make_copy(insn, op);
+  return true;
+}
+
+/*
+ * Se o uso é o índice de um acesso a vetor. O backend lê índices literais
+ * como os tamanhos dos vetores (em hexadecimal), diferente dos demais
+ * literais, então constantes não são propagadas para eles: o índice fica
+ * calculado em tempo de execução.
+ */
+static bool
+opt_is_index(const struct tac_insn *insn, const uint32_t *use)
+{
+  return ((insn->ttype == t_vread_t) && (use == &insn->op2)) ||
+         ((insn->ttype == t_vcopy_t) && (use == &insn->op1));
+}
+
+static bool
+opt_fold_insn(struct opt_consts *c, struct tac_insn *insn)
+{
+  struct tac_prog *prog = c->prog;
+  bool changed = false;
+  int32_t v1 = 0,
+          v2 = 0,
+          ans = 0;
+
+  // Propaga: usos de valores conhecidos passam a ler a constante
+  uint32_t *uses[TAC_MAX_USES];
+  unsigned int nuses = tac_insn_uses(insn, uses);
+  for (unsigned int u = 0; u < nuses; u++) {
+    if (opt_is_index(insn, uses[u]) || !opt_known(c, *uses[u], &v1))
+      continue;
+    uint32_t op = tac_prog_const(prog, v1);
+    if (op != *uses[u]) {
+      *uses[u] = op;
+      changed = true;
+    }
+  }
+
+  // Dobra
+  switch (insn->ttype) {
+    case t_add_t:
+    case t_sub_t:
+    case t_mul_t:
+    case t_div_t:
+    case t_lt_t:
+    case t_gt_t:
+    case t_le_t:
+    case t_ge_t:
+    case t_eq_t:
+    case t_ne_t:
+    case t_or_t:
+    case t_and_t:
+    case t_pow_t: {
+      bool k1 = opt_known(c, insn->op1, &v1),
+           k2 = opt_known(c, insn->op2, &v2);
+      if (k1 && k2 && opt_eval(insn->ttype, v1, v2, &ans)) {
+        opt_make_copy(insn, tac_prog_const(prog, ans));
+        changed = true;
+      } else if (opt_simplify(prog, insn, k1, v1, k2, v2)) {
+        changed = true;
+      }
+      break;
+    }
+    case t_jmpf_t:
+      if (opt_known(c, insn->op1, &v1)) {
+        // Nunca desvia, ou sempre desvia
+        insn->ttype = (v1 != 0) ? t_nop_t : t_jmp_t;
+        insn->op1 = 0;
+        changed = true;
+      }
+      break;
+    default:
+      break;
+  }
+
+  // Registra (ou invalida) o valor do que a instrução escreveu
+  uint32_t def = tac_insn_def(insn);
+  if ((def != 0) && (def < c->n)) {
+    if ((insn->ttype == t_copy_t) && opt_known(c, insn->op1, &v1)) {
+      c->val[def] = v1;
+      if ((prog->ops[def]->typeinfo.nature == hn_tmp_t) && (c->ndefs[def] == 1))
+        c->stamp[def] = OPT_ALWAYS;
+      else
+        c->stamp[def] = c->epoch;
+    } else {
+      c->stamp[def] = 0;
+    }
+  }
+
+  // Chamadas podem escrever em qualquer global, e t_arg_t escreve no
+  // parâmetro (que pode ser uma variável desta função, se recursiva)
+  if ((insn->ttype == t_call_t) || (insn->ttype == t_arg_t))
+    c->epoch++;
+
+  return changed;
+}
+
+size_t
+opt_fold(struct tac_prog *prog)
+{
+  struct opt_consts c = {
+    prog,
+    prog->nops,
+    opt_calloc(prog->nops, sizeof(*c.val)),
+    opt_calloc(prog->nops, sizeof(*c.stamp)),
+    opt_calloc(prog->nops, sizeof(*c.ndefs)),
+    0
+  };
+  size_t ans = 0;
+
+  for (size_t i = 0; i < prog->ninsns; i++)
+    c.ndefs[tac_insn_def(&prog->insns[i])]++;
+
+  // Fatos sobre variáveis valem só dentro do bloco
+  struct cfg cfg = cfg_build(prog);
+  for (size_t b = 0; b < cfg.nblocks; b++) {
+    c.epoch++;
+    for (size_t i = cfg.blocks[b].first; i < cfg.blocks[b].end; i++) {
+      if (opt_fold_insn(&c, &prog->insns[i]))
+        ans++;
+    }
+  }
+
+  cfg_free(&cfg);
+  free(c.val);
+  free(c.stamp);
+  free(c.ndefs);
+  return ans;
+}
+
+static bool
+opt_nop(struct tac_insn *insn)
+{
+  insn->ttype = t_nop_t;
+  insn->ans = insn->op1 = insn->op2 = 0;
+  return true;
+}
+
+/*
+ * Remove os blocos que não são alcançáveis da entrada da função (após
+ * retornos, desvios incondicionais, condições dobradas). O início e fim da
+ * função ficam, eles delimitam a função para o grafo.
+ */
+static size_t
+opt_dce_unreachable(struct tac_prog *prog)
+{
+  struct cfg cfg = cfg_build(prog);
+  size_t ans = 0;
+
+  for (size_t b = 0; b < cfg.nblocks; b++) {
+    if (cfg.blocks[b].rpo != CFG_NONE)
+      continue;
+    for (size_t i = cfg.blocks[b].first; i < cfg.blocks[b].end; i++) {
+      struct tac_insn *insn = &prog->insns[i];
+      if ((insn->ttype != t_fstart_t) && (insn->ttype != t_fend_t) && (insn->ttype != t_nop_t))
+        ans += opt_nop(insn);
+    }
+  }
+
+  cfg_free(&cfg);
+  return ans;
+}
+
+/*
+ * Remove desvios para o label logo a seguir, e TACs de símbolo, que não
+ * geram código
+ */
+static size_t
+opt_dce_jumps(struct tac_prog *prog)
+{
+  size_t ans = 0;
+
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    struct tac_insn *insn = &prog->insns[i];
+    if (insn->ttype == t_sym_t) {
+      ans += opt_nop(insn);
+      continue;
+    }
+    if ((insn->ttype != t_jmp_t) && (insn->ttype != t_jmpf_t))
+      continue;
+    for (size_t j = i + 1; j < prog->ninsns; j++) {
+      const struct tac_insn *next = &prog->insns[j];
+      if ((next->ttype == t_label_t) && (next->ans == insn->ans)) {
+        ans += opt_nop(insn);
+        break;
+      } else if ((next->ttype != t_label_t) && (next->ttype != t_nop_t) && (next->ttype != t_sym_t)) {
+        break;
+      }
+    }
+  }
+
+  return ans;
+}
+
+/*
+ * Remove labels para os quais nada desvia
+ */
+static size_t
+opt_dce_labels(struct tac_prog *prog)
+{
+  bool *used = opt_calloc(prog->nops, sizeof(*used));
+  size_t ans = 0;
+
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    const struct tac_insn *insn = &prog->insns[i];
+    if ((insn->ttype == t_jmp_t) || (insn->ttype == t_jmpf_t))
+      used[insn->ans] = true;
+  }
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    struct tac_insn *insn = &prog->insns[i];
+    if ((insn->ttype == t_label_t) && !used[insn->ans])
+      ans += opt_nop(insn);
+  }
+
+  free(used);
+  return ans;
+}
+
+/*
+ * Divisão que sabemos falhar em tempo de execução: por zero ou INT32_MIN / -1
+ * com operandos constantes. opt_eval não as dobra e elas não são removidas
+ * mesmo sem uso, então a falha continua acontecendo também quando x * 0 ou
+ * x & 0 descartam o resultado. Divisões por valores que só se conhecem em
+ * tempo de execução não têm essa garantia.
+ */
+static bool
+opt_div_traps(const struct tac_prog *prog, const struct tac_insn *insn)
+{
+  int32_t a = 0,
+          b = 1;
+  if ((insn->ttype != t_div_t) || !tac_prog_const_value(prog, insn->op2, &b))
+    return false;
+  return (b == 0) || ((b == -1) && tac_prog_const_value(prog, insn->op1, &a) && (a == INT32_MIN));
+}
+
+/*
+ * Remove as definições de temporários que nunca são lidos. Remover uma
+ * definição pode zerar os usos de outro temporário, então as definições
+ * mortas passam por uma lista de trabalho. Chamadas ficam, sem o resultado,
+ * e divisões que falham (opt_div_traps) ficam inteiras.
+ */
+static size_t
+opt_dce_temps(struct tac_prog *prog)
+{
+  size_t nops = prog->nops,
+         ans = 0;
+  size_t *nuses = opt_calloc(nops, sizeof(*nuses)),
+         *defstart = opt_calloc(nops + 1, sizeof(*defstart)),
+         *defs = opt_calloc(prog->ninsns, sizeof(*defs)),
+         *work = opt_calloc(prog->ninsns, sizeof(*work));
+  size_t nwork = 0;
+
+  // Usos, e definições de cada operando em defs[defstart[id], defstart[id + 1])
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    struct tac_insn *insn = &prog->insns[i];
+    uint32_t *uses[TAC_MAX_USES];
+    unsigned int n = tac_insn_uses(insn, uses);
+    for (unsigned int u = 0; u < n; u++)
+      nuses[*uses[u]]++;
+    defstart[tac_insn_def(insn) + 1]++;
+  }
+  for (size_t id = 0; id < nops; id++)
+    defstart[id + 1] += defstart[id];
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    uint32_t def = tac_insn_def(&prog->insns[i]);
+    defs[defstart[def]++] = i;
+  }
+  for (size_t id = nops; id > 0; id--)
+    defstart[id] = defstart[id - 1];
+  defstart[0] = 0;
+
+  for (uint32_t id = 1; id < nops; id++) {
+    if ((prog->ops[id]->typeinfo.nature != hn_tmp_t) || (nuses[id] > 0))
+      continue;
+    for (size_t d = defstart[id]; d < defstart[id + 1]; d++)
+      work[nwork++] = defs[d];
+  }
+
+  while (nwork > 0) {
+    struct tac_insn *insn = &prog->insns[work[--nwork]];
+    if (tac_insn_def(insn) == 0)
+      continue; // já removida
+    if (insn->ttype == t_call_t) {
+      insn->ans = 0;
+      ans++;
+      continue;
+    }
+    if (opt_div_traps(prog, insn))
+      continue;
+    uint32_t *uses[TAC_MAX_USES];
+    unsigned int n = tac_insn_uses(insn, uses);
+    for (unsigned int u = 0; u < n; u++) {
+      uint32_t id = *uses[u];
+      if ((prog->ops[id]->typeinfo.nature != hn_tmp_t) || (--nuses[id] > 0))
+        continue;
+      for (size_t d = defstart[id]; d < defstart[id + 1]; d++)
+        work[nwork++] = defs[d];
+    }
+    ans += opt_nop(insn);
+  }
+
+  free(nuses);
+  free(defstart);
+  free(defs);
+  free(work);
+  return ans;
+}
+
+size_t
+opt_dce(struct tac_prog *prog)
+{
+  size_t ans = opt_dce_unreachable(prog);
+  ans += opt_dce_jumps(prog);
+  ans += opt_dce_labels(prog);
+  ans += opt_dce_temps(prog);
+  tac_prog_compact(prog);
+  return ans;
+}
+
+/*
+ * Entrada da tabela de expressões de opt_lvn: a expressão (ttype, a, b, mem),
+ * em números de valor, está guardada no operando holder, enquanto ele tiver o
+ * número de valor holdervn
+ */
+struct opt_expr {
+  enum ttype_t ttype;
+  size_t a, b, mem;
+  uint32_t holder;
+  size_t holdervn;
+  size_t stamp;
+};
+
+/*
+ * Números de valor dos operandos de um bloco. O número de id vale se
+ * stamp[id] == epoch, senão o operando recebe um número novo quando lido.
+ */
+struct opt_lvn {
+  size_t *vn;
+  size_t *stamp;
+  size_t epoch;
+  size_t next;  // próximo número de valor
+  size_t mem;   // versão da memória dos vetores, muda a cada t_vcopy_t
+  struct opt_expr *table;
+  size_t mask;
+};
+
+static size_t
+opt_lvn_fresh(struct opt_lvn *l, uint32_t id)
+{
+  l->vn[id] = l->next++;
+  l->stamp[id] = l->epoch;
+  return l->vn[id];
+}
+
+static size_t
+opt_lvn_get(struct opt_lvn *l, uint32_t id)
+{
+  if (l->stamp[id] == l->epoch)
+    return l->vn[id];
+  return opt_lvn_fresh(l, id);
+}
+
+/*
+ * Normaliza a expressão para que formas equivalentes tenham a mesma chave:
+ * operandos de operações comutativas ordenados, > e >= como < e <= trocados
+ */
+static void
+opt_lvn_normalize(enum ttype_t *ttype, size_t *a, size_t *b)
+{
+  size_t tmp = *a;
+  switch (*ttype) {
+    case t_gt_t:
+      *ttype = t_lt_t;
+      *a = *b;
+      *b = tmp;
+      break;
+    case t_ge_t:
+      *ttype = t_le_t;
+      *a = *b;
+      *b = tmp;
+      break;
+    case t_add_t:
+    case t_mul_t:
+    case t_eq_t:
+    case t_ne_t:
+    case t_and_t:
+    case t_or_t:
+      if (*a > *b) {
+        *a = *b;
+        *b = tmp;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static struct opt_expr *
+opt_lvn_find(struct opt_lvn *l, enum ttype_t ttype, size_t a, size_t b, size_t mem)
+{
+  size_t hash = ((size_t)ttype * 0x9e3779b97f4a7c15ULL) ^ (a * 0xc2b2ae3d27d4eb4fULL) ^
+                (b * 0x165667b19e3779f9ULL) ^ (mem * 0x27d4eb2f165667c5ULL);
+  hash ^= hash >> 29;
+  for (size_t addr = hash & l->mask; ; addr = (addr + 1) & l->mask) {
+    struct opt_expr *e = &l->table[addr];
+    if (e->stamp != l->epoch)
+      return e; // livre (ou de um bloco anterior)
+    if ((e->ttype == ttype) && (e->a == a) && (e->b == b) && (e->mem == mem))
+      return e;
+  }
+}
+
+static bool
+opt_lvn_insn(struct opt_lvn *l, struct tac_insn *insn)
+{
+  size_t a = 0,
+         b = 0,
+         mem = 0;
+  enum ttype_t ttype = insn->ttype;
+
+  switch (ttype) {
+    case t_add_t:
+    case t_sub_t:
+    case t_mul_t:
+    case t_div_t:
+    case t_lt_t:
+    case t_gt_t:
+    case t_le_t:
+    case t_ge_t:
+    case t_eq_t:
+    case t_ne_t:
+    case t_or_t:
+    case t_and_t:
+    case t_pow_t:
+      a = opt_lvn_get(l, insn->op1);
+      b = opt_lvn_get(l, insn->op2);
+      opt_lvn_normalize(&ttype, &a, &b);
+      break;
+    case t_vread_t:
+      // O vetor é identificado pelo operando, e a memória pela versão
+      a = insn->op1;
+      b = opt_lvn_get(l, insn->op2);
+      mem = l->mem;
+      break;
+    case t_copy_t:
+      l->vn[insn->ans] = opt_lvn_get(l, insn->op1);
+      l->stamp[insn->ans] = l->epoch;
+      return false;
+    case t_vcopy_t:
+      l->mem++;
+      return false;
+    case t_call_t:
+    case t_arg_t:
+      // Podem escrever em qualquer global (e t_arg_t no parâmetro): nada do
+      // que sabemos vale mais, nem a tabela
+      l->epoch++;
+      return false;
+    default:
+      if (tac_insn_def(insn) != 0)
+        opt_lvn_fresh(l, tac_insn_def(insn));
+      return false;
+  }
+
+  struct opt_expr *e = opt_lvn_find(l, ttype, a, b, mem);
+  if ((e->stamp == l->epoch) && (opt_lvn_get(l, e->holder) == e->holdervn)) {
+    // Já calculado e ainda guardado em holder
+    opt_make_copy(insn, e->holder);
+    l->vn[insn->ans] = e->holdervn;
+    l->stamp[insn->ans] = l->epoch;
+    return true;
+  }
+
+  opt_lvn_fresh(l, insn->ans);
+  e->ttype = ttype;
+  e->a = a;
+  e->b = b;
+  e->mem = mem;
+  e->holder = insn->ans;
+  e->holdervn = l->vn[insn->ans];
+  e->stamp = l->epoch;
+  return false;
+}
+
+size_t
+opt_lvn(struct tac_prog *prog)
+{
+  struct opt_lvn l;
+  size_t size = 64,
+         ans = 0;
+  while (size < prog->ninsns * 2)
+    size *= 2;
+  l.vn = opt_calloc(prog->nops, sizeof(*l.vn));
+  l.stamp = opt_calloc(prog->nops, sizeof(*l.stamp));
+  l.table = opt_calloc(size, sizeof(*l.table));
+  l.mask = size - 1;
+  l.epoch = 0;
+  l.next = 1;
+  l.mem = 0;
+
+  struct cfg cfg = cfg_build(prog);
+  for (size_t bl = 0; bl < cfg.nblocks; bl++) {
+    l.epoch++;
+    for (size_t i = cfg.blocks[bl].first; i < cfg.blocks[bl].end; i++) {
+      if (opt_lvn_insn(&l, &prog->insns[i]))
+        ans++;
+    }
+  }
+
+  cfg_free(&cfg);
+  free(l.vn);
+  free(l.stamp);
+  free(l.table);
+  return ans;
+}
+
+/*
+ * Cópias disponíveis num bloco: o operando id tem o mesmo valor que src[id]
+ * se stamp[id] == epoch e src[id] não foi escrito desde a cópia (ver[src]
+ * ainda é srcver[id])
+ */
+struct opt_copies {
+  uint32_t *src;
+  size_t *srcver;
+  size_t *ver;
+  size_t *stamp;
+  size_t epoch;
+};
+
+static bool
+opt_copies_insn(struct opt_copies *c, struct tac_insn *insn)
+{
+  bool changed = false;
+
+  // Usos de cópias passam a ler a origem
+  uint32_t *uses[TAC_MAX_USES];
+  unsigned int nuses = tac_insn_uses(insn, uses);
+  for (unsigned int u = 0; u < nuses; u++) {
+    uint32_t id = *uses[u];
+    if (opt_is_index(insn, uses[u]) || (c->stamp[id] != c->epoch) ||
+        (c->ver[c->src[id]] != c->srcver[id]))
+      continue;
+    *uses[u] = c->src[id];
+    changed = true;
+  }
+
+  if ((insn->ttype == t_copy_t) && (insn->ans == insn->op1))
+    return opt_nop(insn);
+
+  uint32_t def = tac_insn_def(insn);
+  if (def != 0) {
+    c->ver[def]++;
+    c->stamp[def] = 0;
+  }
+  if (insn->ttype == t_copy_t) {
+    c->src[def] = insn->op1;
+    c->srcver[def] = c->ver[insn->op1];
+    c->stamp[def] = c->epoch;
+  } else if ((insn->ttype == t_call_t) || (insn->ttype == t_arg_t)) {
+    // Podem escrever em qualquer global
+    c->epoch++;
+  }
+
+  return changed;
+}
+
+/*
+ * Se dá para mover a escrita de dest para antes de insns(first, last): nada
+ * no meio lê ou escreve dest, nem pode fazê-lo indiretamente (chamadas)
+ */
+static bool
+opt_copies_can_sink(struct tac_prog *prog, size_t first, size_t last, uint32_t dest)
+{
+  if (last - first > OPT_MAX_COALESCE)
+    return false;
+
+  for (size_t i = first + 1; i < last; i++) {
+    struct tac_insn *insn = &prog->insns[i];
+    if ((insn->ttype == t_call_t) || (insn->ttype == t_arg_t) || (tac_insn_def(insn) == dest))
+      return false;
+    uint32_t *uses[TAC_MAX_USES];
+    unsigned int nuses = tac_insn_uses(insn, uses);
+    for (unsigned int u = 0; u < nuses; u++) {
+      if (*uses[u] == dest)
+        return false;
+    }
+  }
+
+  return true;
+}
+
+size_t
+opt_copies(struct tac_prog *prog)
+{
+  struct opt_copies c = {
+    opt_calloc(prog->nops, sizeof(*c.src)),
+    opt_calloc(prog->nops, sizeof(*c.srcver)),
+    opt_calloc(prog->nops, sizeof(*c.ver)),
+    opt_calloc(prog->nops, sizeof(*c.stamp)),
+    0
+  };
+  size_t ans = 0;
+
+  // Coalescência primeiro, senão a propagação faria os usos do destino lerem
+  // o temporário: t = expr; ...; a = t, com t temporário escrito e lido uma
+  // vez só, vira a = expr. Usa os arrays da propagação, ainda zerados, para
+  // contar definições e usos.
+  struct cfg cfg = cfg_build(prog);
+  size_t *ndefs = c.stamp,
+         *nuses = c.ver,
+         *defpos = c.srcver;
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    struct tac_insn *insn = &prog->insns[i];
+    uint32_t *uses[TAC_MAX_USES];
+    unsigned int n = tac_insn_uses(insn, uses);
+    for (unsigned int u = 0; u < n; u++)
+      nuses[*uses[u]]++;
+    uint32_t def = tac_insn_def(insn);
+    ndefs[def]++;
+    defpos[def] = i;
+  }
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    struct tac_insn *insn = &prog->insns[i];
+    if (insn->ttype != t_copy_t)
+      continue;
+    uint32_t t = insn->op1;
+    if ((prog->ops[t]->typeinfo.nature != hn_tmp_t) || (ndefs[t] != 1) || (nuses[t] != 1))
+      continue;
+    size_t d = defpos[t];
+    // Numa cadeia t2 = a + b; t6 = t2; t3 = t6 a definição de t6 já foi
+    // trocada pela de t2, então confere que d ainda define t
+    if ((d > i) || (tac_insn_def(&prog->insns[d]) != t) || (cfg.insnblock[d] != cfg.insnblock[i]) ||
+        !opt_copies_can_sink(prog, d, i, insn->ans))
+      continue;
+    prog->insns[d].ans = insn->ans;
+    defpos[insn->ans] = d;
+    ans += opt_nop(insn);
+  }
+
+  // Propagação, dentro de cada bloco
+  for (size_t id = 0; id < prog->nops; id++)
+    c.stamp[id] = c.ver[id] = 0;
+  for (size_t b = 0; b < cfg.nblocks; b++) {
+    c.epoch++;
+    for (size_t i = cfg.blocks[b].first; i < cfg.blocks[b].end; i++) {
+      if (opt_copies_insn(&c, &prog->insns[i]))
+        ans++;
+    }
+  }
+
+  cfg_free(&cfg);
+  free(c.src);
+  free(c.srcver);
+  free(c.ver);
+  free(c.stamp);
+  return ans;
+}
+
+void
+opt_run(struct tac_prog *prog)
+{
+  // Antes de tudo, para que as demais otimizem o corpo expandido junto com
+  // os argumentos de cada chamada
+  size_t ninline = inline_calls(prog);
+  LOG_DEBUG("Inlined %zu calls\n", ninline);
+
+  // Cada passagem pode abrir oportunidades para as outras. Limitado, por
+  // garantia, mas normalmente estabiliza em 2 ou 3 iterações.
+  for (int i = 0; i < OPT_MAX_ROUNDS; i++) {
+    size_t nfold = opt_fold(prog),
+           nlvn = opt_lvn(prog),
+           ncopy = opt_copies(prog),
+           ndead = opt_dce(prog),
+           nhoist = loop_licm(prog),
+           nivs = loop_ivs(prog);
+    LOG_DEBUG("Round %d: folded %zu, reused %zu, copies %zu, removed %zu, hoisted %zu, induction %zu TACs\n", i,
+              nfold, nlvn, ncopy, ndead, nhoist, nivs);
+    if ((nfold == 0) && (nlvn == 0) && (ncopy == 0) && (ndead == 0) && (nhoist == 0) && (nivs == 0))
+      break;
+  }
+}
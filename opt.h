@@ -0,0 +1,45 @@
+#pragma once
+
+#include "tac.h"
+
+/*
+ * Dobramento e propagação de constantes: expressões com operandos constantes
+ * viram cópias do resultado, constantes são propagadas para os usos (de
+ * temporários definidos uma vez, em todo o programa, e de variáveis, dentro
+ * do bloco básico) e desvios condicionais em constantes viram t_jmp_t ou são
+ * removidos. Retorna quantas instruções mudaram.
+ */
+size_t
+opt_fold(struct tac_prog *prog);
+
+/*
+ * Numeração de valores local: dentro de cada bloco básico, uma expressão
+ * (aritmética, comparação, leitura de vetor) já calculada e cujo resultado
+ * ainda está guardado vira uma cópia dele. Cópias, escritas em vetores,
+ * chamadas e argumentos invalidam o que for preciso. Retorna quantas
+ * expressões foram reaproveitadas.
+ */
+size_t
+opt_lvn(struct tac_prog *prog);
+
+/*
+ * Propagação de cópias, dentro de cada bloco, e coalescência de temporários:
+ * t = b + c; a = t vira a = b + c quando t não é usado em outro lugar.
+ * Retorna quantas instruções mudaram.
+ */
+size_t
+opt_copies(struct tac_prog *prog);
+
+/*
+ * Eliminação de código morto: blocos inalcançáveis, desvios para a próxima
+ * instrução, labels sem desvios e definições de temporários nunca lidos.
+ * Retorna quantas instruções foram removidas ou mudaram.
+ */
+size_t
+opt_dce(struct tac_prog *prog);
+
+/*
+ * Executa as otimizações sobre o programa, entre tac_gencode e asm_print
+ */
+void
+opt_run(struct tac_prog *prog);
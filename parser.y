@@ -42,7 +42,7 @@ void yyerror(char const *s);
 
 %token TOKEN_ERROR
 
-%type<node> expr fcall_arg fcall_arglist fcall_arglistresto fcall lit operando id attr bloco cmd cmdlist flow ifelse elseopt whiledo loop print return read parglist parg string type fsig arg arglist arglistresto gsimple gvector global gvectoropt vlist programa root func
+%type<node> expr fcall_arg fcall_arglist fcall_args fcall lit operando id attr bloco cmd cmdne cmdlist flow ifelse elseopt whiledo loop print return read parglist parg string type fsig arg arglist args gsimple gvector global gvectoropt vlist programa root func
 
 %define parse.error verbose
 
@@ -58,10 +58,15 @@ void yyerror(char const *s);
 root:
   programa { $$ = $1; AST_HEAD = $1; }
 
+/*
+ * As listas são recursivas à esquerda, para o bison reduzir cada item assim
+ * que ele é lido (pilha limitada), e viram um único nodo com os itens como
+ * filhos, na ordem, ver ast_append.
+ */
 programa:
-  global programa { $$ = ast_create(a_plist_t, NULL, 2, $1, $2); }|
-  func programa   { $$ = ast_create(a_plist_t, NULL, 2, $1, $2); }|
-                  { $$ = NULL; };
+  programa global { $$ = ast_append($1, $2); }|
+  programa func   { $$ = ast_append($1, $2); }|
+                  { $$ = ast_create(a_plist_t, NULL, 0); };
 
 /*
  * Globais
@@ -92,12 +97,12 @@ fsig:
   id '(' arglist ')' '=' type { $$ = ast_create(a_fsig_t, NULL, 3, $1, $3, $6); };
 
 arglist:
-  arg arglistresto  { $$ = ast_create(a_csv_t, NULL, 2, $1, $2); }|
-                    { $$ = NULL; };
+  args { $$ = $1; }|
+       { $$ = NULL; };
 
-arglistresto:
-  ',' arg arglistresto { $$ = ast_create(a_csv_t, NULL, 2, $2, $3); }|
-                       { $$ = NULL; };
+args:
+  arg          { $$ = ast_create(a_csv_t, NULL, 1, $1); }|
+  args ',' arg { $$ = ast_append($1, $3); };
 
 arg:
   id '=' type { $$ = ast_create(a_tvar_t, NULL, 2, $1, $3); };
@@ -107,22 +112,29 @@ arg:
 bloco:
   '{' cmdlist '}' { $$ = ast_create(a_block_t, NULL, 1, $2); };
 
+/*
+ * Comandos vazios não entram na lista, senão ela poderia crescer
+ * indefinidamente com vazios sem consumir nada
+ */
 cmdlist:
-  cmd         { $$ = $1; }|
-  cmd cmdlist { $$ = ast_create(a_cmdl_t, NULL, 2, $1, $2); };
+  cmdlist cmdne { $$ = ast_append($1, $2); }|
+                { $$ = ast_create(a_cmdl_t, NULL, 0); };
 
 /*
  * Vai gerar shift/reduce, professor disse que é ok. Remover o vazio para
  * debugar outros conflitos
  */
 cmd:
+  cmdne  { $$ = $1; }|
+         { $$ = NULL; };
+
+cmdne:
   bloco  { $$ = $1; }|
   attr   { $$ = $1; }|
   flow   { $$ = $1; }|
   read   { $$ = $1; }|
   print  { $$ = $1; }|
-  return { $$ = $1; }|
-         { $$ = NULL; };
+  return { $$ = $1; };
 
 attr:
   id '=' expr              { $$ = ast_create(a_attr_t, NULL, 2, $1, $3); } |
@@ -135,8 +147,8 @@ print:
   KW_PRINT parglist { $$ = ast_create(a_print_t, NULL, 1, $2); };
 
 parglist:
-  parg              { $$ = ast_create(a_csv_t, NULL, 1, $1); ; }|
-  parg ',' parglist { $$ = ast_create(a_csv_t, NULL, 2, $1, $3); };
+  parg              { $$ = ast_create(a_csv_t, NULL, 1, $1); }|
+  parglist ',' parg { $$ = ast_append($1, $3); };
 
 parg:
   string { $$ = $1; }|
@@ -180,11 +192,11 @@ fcall:
   id '(' fcall_arglist ')' { $$ = ast_create(a_call_t, NULL, 2, $1, $3);};
 
 fcall_arglist:
-  fcall_arg fcall_arglistresto        { $$ = ast_create(a_csv_t, NULL, 2, $1, $2);} |
-                                      { $$ = NULL; };
-fcall_arglistresto:
-  ',' fcall_arg fcall_arglistresto    { $$ = ast_create(a_csv_t, NULL, 2, $2, $3);} |
+  fcall_args                          { $$ = $1; } |
                                       { $$ = NULL; };
+fcall_args:
+  fcall_arg                           { $$ = ast_create(a_csv_t, NULL, 1, $1); } |
+  fcall_args ',' fcall_arg            { $$ = ast_append($1, $3); };
 fcall_arg:
   expr { $$ = $1; };
 
@@ -228,8 +240,8 @@ lit:
  LIT_CHAR    { $$ = ast_create(a_sym_t, $1, 0); };
 
 vlist:
-  lit        { $$ = $1; }|
-  lit vlist  { $$ = ast_create(a_vlist_t, NULL, 2, $1, $2); };
+  lit        { $$ = ast_create(a_vlist_t, NULL, 1, $1); }|
+  vlist lit  { $$ = ast_append($1, $2); };
 
 
 %%
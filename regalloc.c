@@ -0,0 +1,379 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "regalloc.h"
+#include "cfg.h"
+#include "hash.h"
+#include "ast.h"
+#include "logging.h"
+
+// Palavras de 64 bits por conjunto de candidatos
+#define RA_WORDS(n) (((n) + 63) / 64)
+#define RA_ALL ((1u << RA_NREGS) - 1)
+#define RA_CALLEE ((1u << RA_NCALLEE) - 1)
+
+static void *
+ra_calloc(size_t n, size_t size)
+{
+  void *ans = calloc(n ? n : 1, size);
+  if (!ans)
+    REPORT_AND_EXIT;
+  return ans;
+}
+
+// Instruções que chamam outra função e destroem os registradores não
+// preservados
+static bool
+ra_is_call(enum ttype_t ttype)
+{
+  return (ttype == t_call_t) || (ttype == t_print_t) || (ttype == t_read_t);
+}
+
+/*
+ * Intervalo de vida de um temporário. As posições são dobradas: a instrução i
+ * lê os operandos em 2i e escreve o resultado em 2i + 1, então um temporário
+ * lido pela última vez em i pode dividir o registrador com o escrito em i.
+ */
+struct ra_interval {
+  uint32_t id;
+  size_t start, end;
+  bool call; // vivo durante uma chamada
+};
+
+static int
+ra_cmp_start(const void *a, const void *b)
+{
+  const struct ra_interval *ia = a,
+                           *ib = b;
+  if (ia->start != ib->start)
+    return (ia->start < ib->start) ? -1 : 1;
+  return (ia->id < ib->id) ? -1 : (ia->id > ib->id);
+}
+
+/*
+ * Estado da alocação
+ */
+struct ra {
+  const struct tac_prog *prog;
+  struct cfg cfg;
+  struct regalloc *ans;
+  size_t *func;      // função de cada candidato, RA_GLOBAL se não é candidato
+  size_t *param;     // função de que o operando é parâmetro, CFG_NONE se nenhuma
+  uint32_t *local;   // índice do candidato na sua função
+  size_t *ncalls;    // chamadas antes de cada instrução
+};
+
+static void
+ra_bit_set(uint64_t *set, uint32_t i)
+{
+  set[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static bool
+ra_bit_get(const uint64_t *set, uint32_t i)
+{
+  return (set[i / 64] >> (i % 64)) & 1;
+}
+
+/*
+ * Candidatos: temporários e parâmetros usados numa única função (a sua, no
+ * caso dos parâmetros) e que não são destino de read (que escreve na memória).
+ * Parâmetros com o mesmo nome em funções diferentes são o mesmo símbolo e
+ * ficam de fora.
+ */
+static void
+ra_candidates(struct ra *r)
+{
+  const struct tac_prog *prog = r->prog;
+  bool *excluded = ra_calloc(prog->nops, sizeof(*excluded));
+
+  for (size_t id = 0; id < prog->nops; id++) {
+    r->func[id] = RA_GLOBAL;
+    r->param[id] = CFG_NONE;
+  }
+
+  for (size_t f = 0; f < r->cfg.nfuncs; f++) {
+    struct hash_node *func = prog->ops[prog->insns[r->cfg.funcs[f].fstart].ans],
+                     *param = NULL;
+    for (size_t k = 0; (param = ast_func_param(func, k)) != NULL; k++) {
+      uint32_t id = param->opid;
+      if (id == 0)
+        continue; // nunca usado
+      if (r->param[id] != CFG_NONE)
+        excluded[id] = true;
+      r->param[id] = f;
+    }
+  }
+
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    struct tac_insn insn = prog->insns[i];
+    size_t block = r->cfg.insnblock[i],
+           func = (block == CFG_NONE) ? CFG_NONE : r->cfg.blocks[block].func;
+    uint32_t *uses[TAC_MAX_USES + 1];
+    unsigned int n = tac_insn_uses(&insn, uses);
+    uint32_t def = tac_insn_def(&insn);
+    if (def != 0)
+      uses[n++] = &insn.ans;
+
+    for (unsigned int u = 0; u < n; u++) {
+      uint32_t id = *uses[u];
+      if ((id == 0) || ((prog->ops[id]->typeinfo.nature != hn_tmp_t) && (r->param[id] == CFG_NONE)))
+        continue;
+      if ((func == CFG_NONE) || (insn.ttype == t_read_t) ||
+          ((r->param[id] != CFG_NONE) && (r->param[id] != func)) ||
+          ((r->func[id] != RA_GLOBAL) && (r->func[id] != func)))
+        excluded[id] = true;
+      r->func[id] = func;
+    }
+  }
+
+  for (size_t id = 0; id < prog->nops; id++) {
+    if (excluded[id])
+      r->func[id] = RA_GLOBAL;
+  }
+  free(excluded);
+}
+
+/*
+ * Vida dos candidatos da função nos blocos (iterativo, do fim para o começo)
+ * e intervalos como o fecho das posições em que estão vivos
+ */
+static void
+ra_intervals(struct ra *r, size_t f, const uint32_t *cands, size_t ncands, struct ra_interval *iv)
+{
+  const struct tac_prog *prog = r->prog;
+  const struct cfg_func *func = &r->cfg.funcs[f];
+  size_t nblocks = func->end - func->first,
+         words = RA_WORDS(ncands);
+  uint64_t *use = ra_calloc(nblocks * words, sizeof(*use)),
+           *def = ra_calloc(nblocks * words, sizeof(*def)),
+           *in = ra_calloc(nblocks * words, sizeof(*in)),
+           *out = ra_calloc(nblocks * words, sizeof(*out));
+
+  for (size_t c = 0; c < ncands; c++) {
+    iv[c].id = cands[c];
+    iv[c].start = SIZE_MAX;
+    iv[c].end = 0;
+  }
+
+  for (size_t b = 0; b < nblocks; b++) {
+    const struct cfg_block *block = &r->cfg.blocks[func->first + b];
+    for (size_t i = block->first; i < block->end; i++) {
+      struct tac_insn insn = prog->insns[i];
+      uint32_t *uses[TAC_MAX_USES];
+      unsigned int n = tac_insn_uses(&insn, uses);
+      for (unsigned int u = 0; u < n; u++) {
+        uint32_t id = *uses[u];
+        if (r->func[id] != f)
+          continue;
+        uint32_t c = r->local[id];
+        if (!ra_bit_get(&def[b * words], c))
+          ra_bit_set(&use[b * words], c);
+        iv[c].start = (2 * i < iv[c].start) ? 2 * i : iv[c].start;
+        iv[c].end = (2 * i > iv[c].end) ? 2 * i : iv[c].end;
+      }
+      uint32_t id = tac_insn_def(&insn);
+      if ((id != 0) && (r->func[id] == f)) {
+        uint32_t c = r->local[id];
+        ra_bit_set(&def[b * words], c);
+        iv[c].start = (2 * i + 1 < iv[c].start) ? 2 * i + 1 : iv[c].start;
+        iv[c].end = (2 * i + 1 > iv[c].end) ? 2 * i + 1 : iv[c].end;
+      }
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t b = nblocks; b-- > 0;) {
+      const struct cfg_block *block = &r->cfg.blocks[func->first + b];
+      uint64_t *bout = &out[b * words],
+               *bin = &in[b * words];
+      for (unsigned int s = 0; s < block->nsucc; s++) {
+        const uint64_t *sin = &in[(block->succ[s] - func->first) * words];
+        for (size_t w = 0; w < words; w++)
+          bout[w] |= sin[w];
+      }
+      for (size_t w = 0; w < words; w++) {
+        uint64_t nin = use[b * words + w] | (bout[w] & ~def[b * words + w]);
+        if (nin != bin[w]) {
+          bin[w] = nin;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  // Vivo na entrada do bloco: desde antes da primeira leitura; na saída: até
+  // depois da última escrita
+  for (size_t b = 0; b < nblocks; b++) {
+    const struct cfg_block *block = &r->cfg.blocks[func->first + b];
+    for (uint32_t c = 0; c < ncands; c++) {
+      if (ra_bit_get(&in[b * words], c) && (2 * block->first < iv[c].start))
+        iv[c].start = 2 * block->first;
+      if (ra_bit_get(&out[b * words], c) && (2 * block->end > iv[c].end))
+        iv[c].end = 2 * block->end;
+    }
+  }
+
+  // Parâmetros são escritos na entrada da função, todos ao mesmo tempo
+  for (size_t c = 0; c < ncands; c++) {
+    if (r->param[iv[c].id] == f) {
+      size_t entry = 2 * func->fstart + 1;
+      iv[c].start = (entry < iv[c].start) ? entry : iv[c].start;
+      iv[c].end = (entry > iv[c].end) ? entry : iv[c].end;
+    }
+  }
+
+  // Atravessa uma chamada na instrução i se start < 2i e 2i + 1 < end
+  for (size_t c = 0; c < ncands; c++) {
+    size_t lo = iv[c].start / 2 + 1,
+           hi = iv[c].end / 2;
+    iv[c].call = (hi > lo) && (r->ncalls[hi] > r->ncalls[lo]);
+  }
+
+  free(use);
+  free(def);
+  free(in);
+  free(out);
+}
+
+/*
+ * Varredura linear: percorre os intervalos por início, liberando os
+ * registradores dos que já terminaram
+ */
+static void
+ra_scan(struct ra *r, size_t f, struct ra_interval *iv, size_t n)
+{
+  int *reg = r->ans->reg;
+  size_t active[RA_NREGS],
+         nactive = 0;
+  unsigned int free_regs = RA_ALL;
+
+  qsort(iv, n, sizeof(*iv), ra_cmp_start);
+
+  for (size_t c = 0; c < n; c++) {
+    for (size_t a = 0; a < nactive;) {
+      if (iv[active[a]].end < iv[c].start) {
+        free_regs |= 1u << reg[iv[active[a]].id];
+        active[a] = active[--nactive];
+      } else {
+        a++;
+      }
+    }
+
+    // Sem chamadas no caminho, os não preservados primeiro, que não precisam
+    // ser salvos
+    unsigned int allowed = iv[c].call ? RA_CALLEE : RA_ALL,
+                 avail = free_regs & allowed;
+    if (!iv[c].call && (avail & ~RA_CALLEE))
+      avail &= ~RA_CALLEE;
+
+    if (avail) {
+      int rg = 0;
+      while (!(avail & (1u << rg)))
+        rg++;
+      reg[iv[c].id] = rg;
+      free_regs &= ~(1u << rg);
+      active[nactive++] = c;
+      continue;
+    }
+
+    // Sem registrador livre: fica na memória quem termina mais tarde
+    size_t victim = nactive;
+    for (size_t a = 0; a < nactive; a++) {
+      if ((allowed & (1u << reg[iv[active[a]].id])) &&
+          ((victim == nactive) || (iv[active[a]].end > iv[active[victim]].end)))
+        victim = a;
+    }
+    if ((victim < nactive) && (iv[active[victim]].end > iv[c].end)) {
+      reg[iv[c].id] = reg[iv[active[victim]].id];
+      reg[iv[active[victim]].id] = RA_NONE;
+      active[victim] = c;
+    }
+  }
+
+  for (size_t c = 0; c < n; c++) {
+    if ((reg[iv[c].id] != RA_NONE) && (reg[iv[c].id] < RA_NCALLEE))
+      r->ans->saved[f] |= 1u << reg[iv[c].id];
+  }
+}
+
+struct regalloc
+regalloc_run(const struct tac_prog *prog)
+{
+  struct regalloc ans;
+  struct ra r;
+
+  r.prog = prog;
+  r.cfg = cfg_build(prog);
+  r.ans = &ans;
+  ans.nfuncs = r.cfg.nfuncs;
+  ans.reg = ra_calloc(prog->nops, sizeof(*ans.reg));
+  ans.saved = ra_calloc(r.cfg.nfuncs, sizeof(*ans.saved));
+  ans.calls = ra_calloc(r.cfg.nfuncs, sizeof(*ans.calls));
+  r.func = ra_calloc(prog->nops, sizeof(*r.func));
+  r.param = ra_calloc(prog->nops, sizeof(*r.param));
+  r.local = ra_calloc(prog->nops, sizeof(*r.local));
+  r.ncalls = ra_calloc(prog->ninsns + 1, sizeof(*r.ncalls));
+
+  for (size_t id = 0; id < prog->nops; id++)
+    ans.reg[id] = RA_NONE;
+  for (size_t i = 0; i < prog->ninsns; i++)
+    r.ncalls[i + 1] = r.ncalls[i] + ra_is_call(prog->insns[i].ttype);
+  for (size_t f = 0; f < r.cfg.nfuncs; f++)
+    ans.calls[f] = r.ncalls[r.cfg.funcs[f].fend + 1] > r.ncalls[r.cfg.funcs[f].fstart];
+
+  ra_candidates(&r);
+
+  // Candidatos agrupados por função
+  size_t *start = ra_calloc(r.cfg.nfuncs + 1, sizeof(*start));
+  uint32_t *cands = ra_calloc(prog->nops, sizeof(*cands));
+  for (size_t id = 0; id < prog->nops; id++) {
+    if (r.func[id] != RA_GLOBAL)
+      start[r.func[id] + 1]++;
+  }
+  for (size_t f = 0; f < r.cfg.nfuncs; f++)
+    start[f + 1] += start[f];
+  size_t *fill = ra_calloc(r.cfg.nfuncs, sizeof(*fill));
+  for (uint32_t id = 0; id < prog->nops; id++) {
+    if (r.func[id] != RA_GLOBAL) {
+      size_t f = r.func[id];
+      r.local[id] = (uint32_t)fill[f]++;
+      cands[start[f] + r.local[id]] = id;
+    }
+  }
+
+  struct ra_interval *iv = ra_calloc(prog->nops, sizeof(*iv));
+  for (size_t f = 0; f < r.cfg.nfuncs; f++) {
+    size_t n = start[f + 1] - start[f];
+    ra_intervals(&r, f, &cands[start[f]], n, iv);
+    ra_scan(&r, f, iv, n);
+  }
+
+  ans.func = r.func;
+
+  cfg_free(&r.cfg);
+  free(r.param);
+  free(r.local);
+  free(r.ncalls);
+  free(start);
+  free(fill);
+  free(cands);
+  free(iv);
+  return ans;
+}
+
+void
+regalloc_free(struct regalloc *ra)
+{
+  free(ra->reg);
+  free(ra->func);
+  free(ra->saved);
+  free(ra->calls);
+  ra->reg = NULL;
+  ra->func = NULL;
+  ra->saved = NULL;
+  ra->calls = NULL;
+  ra->nfuncs = 0;
+}
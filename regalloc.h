@@ -0,0 +1,40 @@
+#pragma once
+
+#include "tac.h"
+
+/*
+ * Registradores disponíveis para os temporários e parâmetros. Os RA_NCALLEE
+ * primeiros são preservados pelas funções chamadas (a função que os usa salva
+ * e restaura), os demais não, e só recebem valores que não estão vivos
+ * durante uma chamada. Quais são os registradores fica a cargo do backend.
+ */
+#define RA_NREGS 11
+#define RA_NCALLEE 5
+#define RA_NONE (-1)
+// Operando que não pertence a uma função só
+#define RA_GLOBAL ((size_t)-1)
+
+/*
+ * Resultado da alocação
+ */
+struct regalloc {
+  int *reg;            // registrador de cada operando (por id), RA_NONE se fica na memória
+  size_t *func;        // função dona de cada temporário ou parâmetro alocável, RA_GLOBAL para os demais
+  unsigned int *saved; // por função, na ordem do programa: bit r marca que usa o registrador preservado r
+  bool *calls;         // por função, se ela chama outras (call, print ou read)
+  size_t nfuncs;
+};
+
+/*
+ * Análise de vida sobre o CFG de cada função e alocação por varredura linear
+ * (linear scan): cada valor vivo em [início, fim] recebe um registrador livre
+ * ou, se não houver, o que termina mais tarde fica na memória. São alocados
+ * temporários e parâmetros (que chegam na entrada da função), desde que
+ * pertençam a uma função só; variáveis globais e operandos de read, que
+ * precisam de endereço, ficam na memória.
+ */
+struct regalloc
+regalloc_run(const struct tac_prog *prog);
+
+void
+regalloc_free(struct regalloc *ra);
@@ -141,15 +141,15 @@ semantic_check_fdecl(struct ast_node *head)
   hash_set_astinfo(fsig->children[0]->symbol, fsig->children[1], __func__, __LINE__);
   // Additionally, set the type of the args, if there are any
   struct ast_node *csv = fsig->children[1];
-  while (csv != NULL) {
-    ast_validate_children(csv, 1, __func__, __LINE__);
-    struct ast_node *arg = csv->children[0];
+  size_t nargs = csv ? csv->nchildren : 0;
+  for (size_t i = 0; i < nargs; i++) {
+    ast_validate_children(csv, i + 1, __func__, __LINE__);
+    struct ast_node *arg = csv->children[i];
     ast_validate_children(arg, 2, __func__, __LINE__);
     ast_validate_symbol(arg, 1, __func__, __LINE__);
     typeinfo.nature = hn_arg_t;
     typeinfo.type = semantic_get_type(arg->children[1]->atype);
     hash_set_typeinfo(arg->children[0]->symbol, typeinfo, __func__, __LINE__);
-    csv = csv->children[1];
   }
   return ans;
 }
@@ -176,12 +176,9 @@ semantic_check_and_set_decls(struct ast_node *head)
       break; // Ignore, we're only checking declarations here
   }
 
-  // TODO Is this the best way to do this?
-  for (size_t nchild = 0; nchild < NUM_CHILDREN; nchild++) {
+  for (size_t nchild = 0; nchild < head->nchildren; nchild++) {
     if (head->children[nchild])
       ans += semantic_check_and_set_decls(head->children[nchild]);
-    else
-      break;
   }
 
   return ans;
@@ -344,12 +341,9 @@ semantic_check_ops(struct ast_node *head)
       break;
   }
 
-  // TODO Is this the best way to do this?
-  for (size_t nchild = 0; nchild < NUM_CHILDREN; nchild++) {
+  for (size_t nchild = 0; nchild < head->nchildren; nchild++) {
     if (head->children[nchild])
       ans += semantic_check_ops(head->children[nchild]);
-    else
-      break;
   }
 
   return ans;
@@ -358,16 +352,8 @@ semantic_check_ops(struct ast_node *head)
 static int
 semantic_get_paramct(struct ast_node *head)
 {
-  int ans = 0;
-
-  if (!head)
-    return ans;
-
-  ans++;
-
-  ans += semantic_get_paramct(head->children[1]);
-
-  return ans;
+  // csv de parâmetros ou argumentos, NULL se nenhum
+  return head ? (int)head->nchildren : 0;
 }
 
 static bool
@@ -392,28 +378,24 @@ semantic_check_paramtype(struct hash_node *fdecl, struct ast_node *callcsv)
 {
   // Assumes both with same param count, possibly zero (both NULL)
   int ans = 0;
-  int parampos = 0;
 
   struct ast_node *declcsv = fdecl->astinfo;
+  int nparams = semantic_get_paramct(declcsv);
 
-  while ((declcsv != NULL) && (callcsv != NULL)) {
-    ast_validate_children(declcsv, 1, __func__, __LINE__);
-    struct ast_node *declarg = declcsv->children[0];
+  for (int parampos = 0; parampos < nparams; parampos++) {
+    ast_validate_children(declcsv, (size_t)parampos + 1, __func__, __LINE__);
+    struct ast_node *declarg = declcsv->children[parampos];
     //ast_validate_children(declarg, 2, __func__, __LINE__);
     ast_validate_symbol(declarg, 1, __func__, __LINE__);
-    ast_validate_children(callcsv, 1, __func__, __LINE__);
+    ast_validate_children(callcsv, (size_t)parampos + 1, __func__, __LINE__);
 
     enum hashtype_t expected = declarg->children[0]->symbol->typeinfo.type,
-                    got = semantic_get_expr_type(callcsv->children[0]);
+                    got = semantic_get_expr_type(callcsv->children[parampos]);
 
     if (!semantic_is_interchangeable(expected, got)) {
       semantic_report(se_badargt_t, fdecl, expected, got, parampos);
       ans++;
     }
-
-    declcsv = declcsv->children[1];
-    callcsv = callcsv->children[1];
-    parampos++;
   }
 
   return ans;
@@ -431,7 +413,7 @@ semantic_check_fcalls(struct ast_node *head)
   if (head->atype == a_call_t) {
     // does not report undeclared identifiers
     ast_validate_symbol(head, 1, __func__, __LINE__);
-    struct hash_node *fdecl = hash_find(head->children[0]->symbol->key);
+    struct hash_node *fdecl = hash_find(head->children[0]->symbol->key, head->children[0]->symbol->len);
     if (fdecl) {
       // Check param count
       if (semantic_check_paramct(fdecl->astinfo, head->children[1], &expected, &got)) {
@@ -444,11 +426,9 @@ semantic_check_fcalls(struct ast_node *head)
     }
   }
 
-  for (size_t nchild = 0; nchild < NUM_CHILDREN; nchild++) {
+  for (size_t nchild = 0; nchild < head->nchildren; nchild++) {
     if (head->children[nchild])
       ans += semantic_check_fcalls(head->children[nchild]);
-    else
-      break;
   }
 
   return ans;
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
 #include "dry.h"
 #include "tac.h"
 #include "hash.h"
@@ -23,11 +24,9 @@ tac_create(enum ttype_t ttype, DRY(struct hash_node *, ans, op1, op2))
 }
 
 static void
-tac_print_node(struct tac_node *head)
+tac_print_node(enum ttype_t ttype, DRY(struct hash_node *, ans, op1, op2))
 {
-  // Assumes head <> NULL
-
-  switch (head->ttype) {
+  switch (ttype) {
     case t_print_t:
       printf("TAC_PRINT");
       break;
@@ -116,22 +115,28 @@ tac_print_node(struct tac_node *head)
     case t_jmpf_t:
       printf("TAC_JUMP_FALSE");
       break;
+    case t_nop_t:
+      printf("TAC_NOP");
+      break;
     default:
-      fprintf(stderr, "Unknown tac type %d\n", head->ttype);
+      fprintf(stderr, "Unknown tac type %d\n", ttype);
       break;
   }
 
-  printf(", %s, %s, %s\n",
-      (head->ans ? head->ans->key : ""),
-      (head->op1 ? head->op1->key : ""),
-      (head->op2 ? head->op2->key : ""));
+  printf(", ");
+  hash_fprint_key(stdout, ans);
+  printf(", ");
+  hash_fprint_key(stdout, op1);
+  printf(", ");
+  hash_fprint_key(stdout, op2);
+  printf("\n");
 }
 
 void
 tac_print(struct tac_node *head)
 {
   while (head) {
-    tac_print_node(head);
+    tac_print_node(head->ttype, head->ans, head->op1, head->op2);
     head = head->next;
   }
 }
@@ -140,67 +145,73 @@ void
 tac_printb(struct tac_node *head)
 {
   while (head) {
-    tac_print_node(head);
+    tac_print_node(head->ttype, head->ans, head->op1, head->op2);
     head = head->prev;
   }
 }
 
 static void
-tac_validate_children(struct tac_node **tarr, size_t nchildren, const char *caller, int line)
+tac_validate_children(struct tac_frag *tarr, size_t nchildren, const char *caller, int line)
 {
   if ((NUM_CHILDREN < nchildren) || (tarr == NULL))
     LOG_NHEAD_AND_EXIT1(caller, line);
 
   for (size_t i = 0; i < nchildren; i++) {
-    if (tarr[i] == NULL)
+    if (tarr[i].tail == NULL)
       LOG_NHEAD_AND_EXIT1(caller, line);
   }
 }
 
-struct tac_node *
-tac_cat_tails(DRY(struct tac_node *, tail1, tail2))
+struct tac_frag
+tac_frag(struct tac_node *node)
+{
+  struct tac_frag ans = { node, node };
+  return ans;
+}
+
+struct tac_frag
+tac_cat(struct tac_frag f1, struct tac_frag f2)
 {
-  if (!tail1)
-    return tail2;
+  if (!f1.head)
+    return f2;
 
-  if (!tail2)
-    return tail1;
+  if (!f2.head)
+    return f1;
 
-  if ((tail1->next != NULL) || (tail2->next != NULL)) {
-    fprintf(stderr, "Not a tail. t1n=%p, t2n=%p\n", (void *)(tail1->next), (void *)(tail2->next));
+  if ((f1.tail->next != NULL) || (f2.head->prev != NULL)) {
+    fprintf(stderr, "Not a fragment. t1n=%p, h2p=%p\n", (void *)(f1.tail->next), (void *)(f2.head->prev));
     exit(E_SYNTAX);
   }
 
-  // Retrocede ao início da lista 2
-  struct tac_node *head = tail2;
-  while (head->prev != NULL)
-    head = head->prev;
-
-  // Concatena e retorna a cauda
-  head->prev = tail1;
-  tail1->next = head;
-  return tail2;
+  f1.tail->next = f2.head;
+  f2.head->prev = f1.tail;
+  f1.tail = f2.tail;
+  return f1;
 }
 
-static struct tac_node *
-tac_cat_tails_arr(struct tac_node **tarr, int nchildren)
+/*
+ * Concatena, em ordem, os fragmentos não vazios de tarr[0..nchildren)
+ */
+static struct tac_frag
+tac_cat_arr(struct tac_frag *tarr, size_t nchildren)
 {
- // Inicializa
-  struct tac_node *ans = NULL;
-  int nchild = 0;
+  struct tac_frag ans = TAC_FRAG_EMPTY;
 
-  // Avança ao último filho + 1
-  while ((nchild < nchildren) && (tarr[nchild] != NULL))
-    nchild++;
-
-  // Concatena todos
-  for (int i = nchild - 1; i >= 0; i--) {
-    ans = tac_cat_tails(tarr[i], ans);
-  }
+  for (size_t i = 0; i < nchildren; i++)
+    ans = tac_cat(ans, tarr[i]);
 
   return ans;
 }
 
+/*
+ * Concatena um fragmento e uma TAC nova, caso mais comum
+ */
+static struct tac_frag
+tac_append(struct tac_frag frag, struct tac_node *node)
+{
+  return tac_cat(frag, tac_frag(node));
+}
+
 static enum ttype_t
 tac_ttype_from_atype(enum atype_t atype)
 {
@@ -246,78 +257,15 @@ tac_ttype_from_atype(enum atype_t atype)
   }
 }
 
-static bool
-tac_is_expr(enum ttype_t ttype)
-{
-  switch (ttype) {
-    case t_sym_t:
-    case t_vread_t:
-    case t_add_t:
-    case t_sub_t:
-    case t_mul_t:
-    case t_div_t:
-    case t_le_t:
-    case t_ge_t:
-    case t_gt_t:
-    case t_lt_t:
-    case t_eq_t:
-    case t_ne_t:
-    case t_or_t:
-    case t_and_t:
-    case t_pow_t:
-    case t_not_t:
-    case t_call_t:
-      return true;
-    default:
-      return false;
-  }
-}
-
-static int
-tac_count_dups(struct tac_node *vmemb)
-{
-  int ans = 0;
-
-  if (!vmemb)
-    return ans;
-
-  switch (vmemb->ttype) {
-    case t_add_t:
-    case t_sub_t:
-    case t_mul_t:
-    case t_div_t:
-    case t_le_t:
-    case t_ge_t:
-    case t_gt_t:
-    case t_lt_t:
-    case t_eq_t:
-    case t_ne_t:
-    case t_or_t:
-    case t_and_t:
-    case t_pow_t:
-    case t_not_t:
-    case t_vread_t:
-      // two operands, each of which may have two operands as well
-      ans += tac_count_dups(vmemb->prev);
-      ans += tac_count_dups(vmemb->prev->prev);
-      ans += 2;
-      // fall through
-    default:
-      break;
-  }
-
-  return ans;
-}
-
-static struct tac_node *
-tac_gencode_expr(enum atype_t atype, struct tac_node **tarr)
+static struct tac_frag
+tac_gencode_expr(enum atype_t atype, struct tac_frag *tarr)
 {
   tac_validate_children(tarr, 2, __func__, __LINE__);
-  return tac_cat_tails(tac_cat_tails(tarr[0], tarr[1]),
-    tac_create(tac_ttype_from_atype(atype), hash_create_dummy(), tarr[0]->ans, tarr[1]->ans));
+  return tac_append(tac_cat(tarr[0], tarr[1]),
+    tac_create(tac_ttype_from_atype(atype), hash_create_dummy(), tarr[0].tail->ans, tarr[1].tail->ans));
 }
 
-static struct tac_node *
+static struct tac_frag
 tac_gencode_sym(struct ast_node *head, size_t nchild)
 {
   char *key = "";
@@ -331,101 +279,187 @@ tac_gencode_sym(struct ast_node *head, size_t nchild)
   }
 
   // Como é o folha, simplesmente cria a TAC e retorna
-  return tac_create(t_sym_t, head->symbol, NULL, NULL);
+  return tac_frag(tac_create(t_sym_t, head->symbol, NULL, NULL));
 }
 
-static struct tac_node *
-tac_gencode_vsym(struct tac_node **tarr)
+static struct tac_frag
+tac_gencode_vsym(struct tac_frag *tarr)
 {
   tac_validate_children(tarr, 2, __func__, __LINE__);
-  return tac_cat_tails(tac_cat_tails(tarr[0], tarr[1]),
-      tac_create(t_vread_t, hash_create_dummy(), tarr[0]->ans, tarr[1]->ans));
+  return tac_append(tac_cat(tarr[0], tarr[1]),
+      tac_create(t_vread_t, hash_create_dummy(), tarr[0].tail->ans, tarr[1].tail->ans));
 }
 
-static struct tac_node *
-tac_gencode_attr(struct tac_node **tarr)
+static struct tac_frag
+tac_gencode_attr(struct tac_frag *tarr)
 {
   tac_validate_children(tarr, 2, __func__, __LINE__);
-  return tac_cat_tails(tac_cat_tails(tarr[0], tarr[1]),
-      tac_create(t_copy_t, tarr[0]->ans, tarr[1]->ans, NULL));
+  return tac_append(tac_cat(tarr[0], tarr[1]),
+      tac_create(t_copy_t, tarr[0].tail->ans, tarr[1].tail->ans, NULL));
 }
 
-static struct tac_node *
-tac_gencode_vattr(struct tac_node **tarr)
+static struct tac_frag
+tac_gencode_vattr(struct tac_frag *tarr)
 {
   tac_validate_children(tarr, 3, __func__, __LINE__);
-  return tac_cat_tails(tac_cat_tails(tarr[0], tarr[1]),
-      tac_cat_tails(tarr[2], tac_create(t_vcopy_t, tarr[0]->ans, tarr[1]->ans, tarr[2]->ans)));
+  return tac_append(tac_cat_arr(tarr, 3),
+      tac_create(t_vcopy_t, tarr[0].tail->ans, tarr[1].tail->ans, tarr[2].tail->ans));
 }
 
-static struct tac_node *
-tac_gencode_call(struct tac_node **tarr)
+static struct tac_frag
+tac_gencode_call(struct ast_node *head)
 {
-  tac_validate_children(tarr, 1, __func__, __LINE__);
-
-  int ndups = 0;
-
-  struct tac_node *vmemb = tarr[1],
-                  *prev = tarr[1],
-                  *ans = NULL;
-
-  while (vmemb != NULL) {
-    ans = tac_cat_tails(prev, tac_create(t_arg_t, vmemb->ans, tarr[0]->ans, NULL));
-    // TODO is there a better way?
-    for (ndups = tac_count_dups(vmemb); ndups > 0; ndups--)
-      vmemb = vmemb->prev;
-    vmemb = vmemb->prev;
-    prev = ans;
+  ast_validate_symbol(head, 1, __func__, __LINE__);
+
+  struct hash_node *func = head->children[0]->symbol;
+  struct ast_node *csv = head->children[1]; // NULL se sem argumentos
+  size_t nargs = csv ? csv->nchildren : 0;
+  struct tac_frag ans = TAC_FRAG_EMPTY,
+                  args = TAC_FRAG_EMPTY;
+
+  // Primeiro calcula todos os argumentos, depois passa eles em ordem, para
+  // que chamadas aninhadas terminem antes da primeira TAC_ARG desta
+  for (size_t i = 0; i < nargs; i++) {
+    ast_validate_children(csv, i + 1, __func__, __LINE__);
+    struct tac_frag targ = tac_gencode(csv->children[i]);
+    ans = tac_cat(ans, targ);
+    args = tac_append(args, tac_create(t_arg_t, targ.tail->ans, func, NULL));
   }
 
-  return tac_cat_tails(ans, tac_create(t_call_t, hash_create_dummy(), tarr[0]->ans, NULL));
+  return tac_append(tac_cat(ans, args), tac_create(t_call_t, hash_create_dummy(), func, NULL));
 }
 
-static struct tac_node *
-tac_gencode_fdecl(struct ast_node *head, struct tac_node **tarr)
+static struct tac_frag
+tac_gencode_fdecl(struct ast_node *head, struct tac_frag *tarr)
 {
   tac_validate_children(tarr, 1, __func__, __LINE__);
   ast_validate_children(head, 2, __func__, __LINE__);
   ast_validate_symbol(head->children[0], 1, __func__, __LINE__);
   // we could use tarr->prev for everyhting but head->children is less confusing
-  struct tac_node *ans = tac_cat_tails(tac_cat_tails(tarr[0], tarr[1]),
-      tac_create(t_fend_t, head->children[0]->children[0]->symbol, NULL, NULL));
+  struct hash_node *func = head->children[0]->children[0]->symbol;
+  struct tac_frag tarr2[4] = {
+    tac_frag(tac_create(t_fstart_t, func, NULL, NULL)),
+    tarr[0],
+    tarr[1],
+    tac_frag(tac_create(t_fend_t, func, NULL, NULL))
+  };
+
+  return tac_cat_arr(tarr2, 4);
+}
 
-  return tac_cat_tails(tac_create(t_fstart_t, head->children[0]->children[0]->symbol, NULL, NULL), ans);
+/*
+ * Comparação com o resultado invertido (a < b vira a >= b), t_unk_t se o nodo
+ * não é uma comparação
+ */
+static enum ttype_t
+tac_ttype_negated(enum atype_t atype)
+{
+  switch (atype) {
+    case a_lt_t:
+      return t_ge_t;
+    case a_gt_t:
+      return t_le_t;
+    case a_le_t:
+      return t_gt_t;
+    case a_ge_t:
+      return t_lt_t;
+    case a_eq_t:
+      return t_ne_t;
+    case a_ne_t:
+      return t_eq_t;
+    default:
+      return t_unk_t;
+  }
 }
 
-static struct tac_node *
-tac_gencode_cond(struct tac_node **tarr)
+/*
+ * Código que desvia para label quando a condição vale jump_if (verdadeiro ou
+ * falso) e segue para a próxima instrução caso contrário. & e | viram
+ * desvios: o lado direito só é avaliado se o esquerdo não decide, e nenhum
+ * temporário booleano é criado para eles.
+ */
+static struct tac_frag
+tac_gencode_branch(struct ast_node *expr, struct hash_node *label, bool jump_if)
 {
-  tac_validate_children(tarr, 1, __func__, __LINE__);
+  while (expr->atype == a_paren_t) {
+    ast_validate_children(expr, 1, __func__, __LINE__);
+    expr = expr->children[0];
+  }
+
+  if ((expr->atype == a_and_t) || (expr->atype == a_or_t)) {
+    ast_validate_children(expr, 2, __func__, __LINE__);
+    // a | b é verdadeiro assim que a é verdadeiro, a & b é falso assim que a
+    // é falso: nesses casos os dois lados desviam direto para label
+    if (jump_if == (expr->atype == a_or_t))
+      return tac_cat(tac_gencode_branch(expr->children[0], label, jump_if),
+                     tac_gencode_branch(expr->children[1], label, jump_if));
+
+    // Senão o lado esquerdo decide pulando o direito
+    struct hash_node *hskip = hash_create_label();
+    struct tac_frag tarr[3] = {
+      tac_gencode_branch(expr->children[0], hskip, !jump_if),
+      tac_gencode_branch(expr->children[1], label, jump_if),
+      tac_frag(tac_create(t_label_t, hskip, NULL, NULL))
+    };
+    return tac_cat_arr(tarr, 3);
+  }
+
+  // Desviar se uma comparação é verdadeira é desviar se a inversa é falsa
+  enum ttype_t negated = tac_ttype_negated(expr->atype);
+  if (jump_if && (negated != t_unk_t)) {
+    ast_validate_children(expr, 2, __func__, __LINE__);
+    struct tac_frag tarr[2] = { tac_gencode(expr->children[0]), tac_gencode(expr->children[1]) };
+    tac_validate_children(tarr, 2, __func__, __LINE__);
+    struct hash_node *hcmp = hash_create_dummy();
+    struct tac_frag tcmp = tac_append(tac_cat(tarr[0], tarr[1]),
+        tac_create(negated, hcmp, tarr[0].tail->ans, tarr[1].tail->ans));
+    return tac_append(tcmp, tac_create(t_jmpf_t, label, hcmp, NULL));
+  }
+
+  struct tac_frag texpr = tac_gencode(expr);
+  tac_validate_children(&texpr, 1, __func__, __LINE__);
+  if (!jump_if)
+    return tac_append(texpr, tac_create(t_jmpf_t, label, texpr.tail->ans, NULL));
+
+  struct hash_node *hskip = hash_create_label();
+  struct tac_frag tarr[4] = {
+    texpr,
+    tac_frag(tac_create(t_jmpf_t, hskip, texpr.tail->ans, NULL)),
+    tac_frag(tac_create(t_jmp_t, label, NULL, NULL)),
+    tac_frag(tac_create(t_label_t, hskip, NULL, NULL))
+  };
+  return tac_cat_arr(tarr, 4);
+}
+
+static struct tac_frag
+tac_gencode_cond(struct ast_node *head)
+{
+  ast_validate_children(head, 1, __func__, __LINE__);
 
   struct hash_node *hlabel = hash_create_label();
-  struct tac_node *tlabel = tac_create(t_label_t, hlabel, NULL, NULL);
+  struct tac_frag tlabel = tac_frag(tac_create(t_label_t, hlabel, NULL, NULL));
 
   // apenas para legibilidade
-  struct tac_node *texpr = tarr[0],
-                  *tcmd  = tarr[1],
-                  *telse = tarr[2],
-                  *tjmpf = tac_create(t_jmpf_t, hlabel, texpr->ans, NULL);
+  struct tac_frag texpr = tac_gencode_branch(head->children[0], hlabel, false),
+                  tcmd  = tac_gencode(head->children[1]),
+                  telse = tac_gencode(head->children[2]);
 
-  if (telse == NULL) {
-    struct tac_node *tarr2[4] = {
+  if (telse.head == NULL) {
+    struct tac_frag tarr2[3] = {
       texpr,
-      tjmpf,
       tcmd,
       tlabel
     };
-    return tac_cat_tails_arr(tarr2, 4);
+    return tac_cat_arr(tarr2, 3);
   } else {
     struct hash_node *hlabel2 = hash_create_label();
-    struct tac_node *tlabel2 = tac_create(t_label_t, hlabel2, NULL, NULL);
+    struct tac_frag tlabel2 = tac_frag(tac_create(t_label_t, hlabel2, NULL, NULL));
 
     // apenas para legibilidade
-    struct tac_node *tjmp = tac_create(t_jmp_t, hlabel2, NULL, NULL);
+    struct tac_frag tjmp = tac_frag(tac_create(t_jmp_t, hlabel2, NULL, NULL));
 
-    struct tac_node *tarr2[7] = {
+    struct tac_frag tarr2[6] = {
       texpr,
-      tjmpf,
       tcmd,
       tjmp,
       tlabel,
@@ -433,21 +467,18 @@ tac_gencode_cond(struct tac_node **tarr)
       tlabel2
     };
 
-    return tac_cat_tails_arr(tarr2, 7);
+    return tac_cat_arr(tarr2, 6);
   }
 }
 
-static struct tac_node *
-tac_gencode_loop(struct tac_node **tarr)
+static struct tac_frag
+tac_gencode_loop(struct tac_frag *tarr)
 {
   tac_validate_children(tarr, 4, __func__, __LINE__);
 
   struct hash_node *hlabel_check = hash_create_label(),
                    *hlabel_end = hash_create_label();
 
-  //return tac_cat_tails(tac_cat_tails(tarr[0], tarr[1]),
-  // tac_create(tac_ttype_from_atype(atype), hash_create_dummy(), tarr[0]->ans, tarr[1]->ans));
-
   // for (id : ini, endc, inc)
   //   cmd
   //
@@ -461,161 +492,142 @@ tac_gencode_loop(struct tac_node **tarr)
   // label_end:
 
   // apenas para legibilidade
-  struct tac_node *tlabel_check = tac_create(t_label_t, hlabel_check, NULL, NULL),
-                  *tlabel_end = tac_create(t_label_t, hlabel_end, NULL, NULL),
-                  *tid = tarr[0],
-                  *tini = tarr[1],
-                  *tendc = tarr[2],
-                  *tinc = tarr[3],
-                  *tcmd = tarr[4], // might be NULL
-                  *tattr = tac_create(t_copy_t, tid->ans, tini->ans, NULL),
-                  *tlt = tac_create(t_lt_t, hash_create_dummy(), tid->ans, tendc->ans),
-                  *tjf = tac_create(t_jmpf_t, hlabel_end, tlt->ans, NULL),
-                  *tadd = tac_create(t_add_t, tid->ans, tid->ans, tinc->ans),
-                  *tj = tac_create(t_jmp_t, hlabel_check, NULL, NULL);
-
-  if (tcmd == NULL) {
-    struct tac_node *tarr2[11] = {
-      tid,
-      tini,
-      tendc,
-      tinc,
-      tattr,
-      tlabel_check,
-      tlt,
-      tjf,
-      tadd,
-      tj,
-      tlabel_end
-    };
-
-    return tac_cat_tails_arr(tarr2, 11);
-  } else {
-    struct tac_node *tarr2[12] = {
-      tid,
-      tini,
-      tendc,
-      tinc,
-      tattr,
-      tlabel_check,
-      tlt,
-      tjf,
-      tcmd,
-      tadd,
-      tj,
-      tlabel_end
-    };
-
-    return tac_cat_tails_arr(tarr2, 12);
-
-  }
+  struct hash_node *id = tarr[0].tail->ans,
+                   *lt = hash_create_dummy();
+  struct tac_frag tarr2[12] = {
+    tarr[0], // id
+    tarr[1], // ini
+    tarr[2], // endc
+    tarr[3], // inc
+    tac_frag(tac_create(t_copy_t, id, tarr[1].tail->ans, NULL)),
+    tac_frag(tac_create(t_label_t, hlabel_check, NULL, NULL)),
+    tac_frag(tac_create(t_lt_t, lt, id, tarr[2].tail->ans)),
+    tac_frag(tac_create(t_jmpf_t, hlabel_end, lt, NULL)),
+    tarr[4], // cmd, pode ser vazio
+    tac_frag(tac_create(t_add_t, id, id, tarr[3].tail->ans)),
+    tac_frag(tac_create(t_jmp_t, hlabel_check, NULL, NULL)),
+    tac_frag(tac_create(t_label_t, hlabel_end, NULL, NULL))
+  };
+
+  return tac_cat_arr(tarr2, 12);
 }
 
-static struct tac_node *
-tac_gencode_read(struct tac_node **tarr)
+static struct tac_frag
+tac_gencode_read(struct tac_frag *tarr)
 {
   tac_validate_children(tarr, 1, __func__, __LINE__);
 
-  return tac_cat_tails(tarr[0], tac_create(t_read_t, tarr[0]->ans, NULL, NULL));
+  return tac_append(tarr[0], tac_create(t_read_t, tarr[0].tail->ans, NULL, NULL));
 }
 
-static struct tac_node *
-tac_gencode_whiledo(struct tac_node **tarr)
+static struct tac_frag
+tac_gencode_whiledo(struct ast_node *head)
 {
-  tac_validate_children(tarr, 1, __func__, __LINE__);
+  ast_validate_children(head, 1, __func__, __LINE__);
 
   struct hash_node *hlabel_check = hash_create_label(),
                    *hlabel_end = hash_create_label();
 
-  struct tac_node *tlabel_check = tac_create(t_label_t, hlabel_check, NULL, NULL),
-                  *tlabel_end = tac_create(t_label_t, hlabel_end, NULL, NULL),
-                  *texpr = tarr[0],
-                  *tcmd = tarr[1], // can be NULL
-                  *tjf = tac_create(t_jmpf_t, hlabel_end, texpr->ans, NULL),
-                  *tj = tac_create(t_jmp_t, hlabel_check, NULL, NULL);
-
   // while ( expr ) cmd
   //
   // label_check:
-  // eval dummy expr
-  // jf dummy label_end
+  // jf expr label_end (ver tac_gencode_branch)
   // cmd
   // j label_check
   // label_end:
 
-  if (tcmd != NULL) {
-    struct tac_node *tarr2[6] = {
-      tlabel_check,
-      texpr,
-      tjf,
-      tcmd,
-      tj,
-      tlabel_end
-    };
-
-    return tac_cat_tails_arr(tarr2, 6);
-  } else {
-    struct tac_node *tarr2[5] = {
-      tlabel_check,
-      texpr,
-      tjf,
-      tj,
-      tlabel_end
-    };
+  struct tac_frag tarr2[5] = {
+    tac_frag(tac_create(t_label_t, hlabel_check, NULL, NULL)),
+    tac_gencode_branch(head->children[0], hlabel_end, false),
+    tac_gencode(head->children[1]), // cmd, pode ser vazio
+    tac_frag(tac_create(t_jmp_t, hlabel_check, NULL, NULL)),
+    tac_frag(tac_create(t_label_t, hlabel_end, NULL, NULL))
+  };
 
-    return tac_cat_tails_arr(tarr2, 5);
-  }
+  return tac_cat_arr(tarr2, 5);
 }
 
-static struct tac_node *
-tac_gencode_ret(struct tac_node **tarr)
+static struct tac_frag
+tac_gencode_ret(struct tac_frag *tarr)
 {
   tac_validate_children(tarr, 1, __func__, __LINE__);
 
-  return tac_cat_tails(tarr[0], tac_create(t_ret_t, tarr[0]->ans, NULL, NULL));
+  return tac_append(tarr[0], tac_create(t_ret_t, tarr[0].tail->ans, NULL, NULL));
 }
 
-static struct tac_node *
-tac_gencode_print(struct tac_node **tarr)
+static struct tac_frag
+tac_gencode_print(struct ast_node *head)
 {
-  tac_validate_children(tarr, 1, __func__, __LINE__);
+  ast_validate_children(head, 1, __func__, __LINE__);
 
-  struct tac_node *tcsvi = tarr[0],
-                  *ans = NULL;
-  do {
-    if (tac_is_expr(tcsvi->ttype)) { // string is t_sym_t as well
-      ans = tac_cat_tails(ans, tac_create(t_print_t, tcsvi->ans, NULL, NULL));
-      tcsvi = tcsvi->prev;
-    } else {
-      tcsvi = NULL;
-    };
-  } while (tcsvi != NULL);
+  struct ast_node *csv = head->children[0];
+  struct tac_frag ans = TAC_FRAG_EMPTY;
+
+  // Cada item (string é t_sym_t também) é calculado e impresso, em ordem
+  for (size_t i = 0; i < csv->nchildren; i++) {
+    ast_validate_children(csv, i + 1, __func__, __LINE__);
+    struct tac_frag titem = tac_gencode(csv->children[i]);
+    ans = tac_append(tac_cat(ans, titem), tac_create(t_print_t, titem.tail->ans, NULL, NULL));
+  }
 
   return ans;
 }
 
-struct tac_node *
+/*
+ * Listas (programa, comandos) são um nodo só com os itens como filhos, basta
+ * concatenar o código de cada um iterativamente
+ */
+static struct tac_frag
+tac_gencode_list(struct ast_node *head)
+{
+  struct tac_frag ans = TAC_FRAG_EMPTY;
+
+  for (size_t i = 0; i < head->nchildren; i++) {
+    if (head->children[i] != NULL)
+      ans = tac_cat(ans, tac_gencode(head->children[i]));
+  }
+
+  return ans;
+}
+
+struct tac_frag
 tac_gencode(struct ast_node *head)
 {
-  struct tac_node *ans = NULL;
+  struct tac_frag ans = TAC_FRAG_EMPTY;
 
   if (!head)
     return ans;
 
-  struct tac_node *_tarr[NUM_CHILDREN] = { NULL },
-                  *tarr[NUM_CHILDREN] = { NULL };
-
-  size_t nchild = 0;
-  while ((nchild < NUM_CHILDREN) && (head->children[nchild] != NULL)) {
-    _tarr[nchild] = tac_gencode(head->children[nchild]);
-    nchild++;
+  // Estes têm listas (tamanho arbitrário) como filhos, ou geram a condição
+  // como desvios, e percorrem a AST eles mesmos
+  switch (head->atype) {
+    case a_plist_t:
+    case a_cmdl_t:
+      return tac_gencode_list(head);
+    case a_call_t:
+      return tac_gencode_call(head);
+    case a_print_t:
+      return tac_gencode_print(head);
+    case a_cond_t:
+      return tac_gencode_cond(head);
+    case a_while_t:
+      return tac_gencode_whiledo(head);
+    case a_csv_t:
+    case a_vlist_t:
+      // Parâmetros da declaração e valores iniciais de vetores, sem código
+      return ans;
+    default:
+      break;
   }
 
-  // Remove NULL from the middle of tarr (empty block, etc)
-  size_t j = 0;
-  for (size_t i = 0; i < NUM_CHILDREN; i++) {
-    if (_tarr[i] != NULL)
-      tarr[j++] = _tarr[i];
+  // tarr[i] é o código do i-ésimo filho, vazio se ele é vazio (bloco vazio,
+  // else ausente, etc). As funções abaixo contam com essas posições.
+  struct tac_frag tarr[NUM_CHILDREN] = { TAC_FRAG_EMPTY };
+
+  size_t nchild = head->nchildren;
+  for (size_t i = 0; i < nchild; i++) {
+    if (head->children[i] != NULL)
+      tarr[i] = tac_gencode(head->children[i]);
   }
 
   switch (head->atype) {
@@ -647,29 +659,27 @@ tac_gencode(struct ast_node *head)
     case a_vattr_t: // done
       ans = tac_gencode_vattr(tarr);
       break;
-    case a_call_t: // done
-      ans = tac_gencode_call(tarr);
-      break;
     case a_fdecl_t: // done
       ans = tac_gencode_fdecl(head, tarr);
       break;
-    case a_cond_t: // done
-      ans = tac_gencode_cond(tarr);
-      break;
     case a_for_t: // done
       ans = tac_gencode_loop(tarr);
       break;
     case a_read_t: // done
       ans = tac_gencode_read(tarr);
       break;
-    case a_while_t: // done
-      ans = tac_gencode_whiledo(tarr);
-      break;
     case a_ret_t: // done
       ans = tac_gencode_ret(tarr);
       break;
-    case a_print_t: // done
-      ans = tac_gencode_print(tarr);
+    case a_plist_t:
+    case a_cmdl_t:
+    case a_call_t:
+    case a_print_t:
+    case a_cond_t:
+    case a_while_t:
+    case a_csv_t:
+    case a_vlist_t:
+      // Tratados antes de gerar os filhos
       break;
     case a_paren_t:
     case a_op_t:
@@ -677,51 +687,242 @@ tac_gencode(struct ast_node *head)
     case a_kwi_t:
     case a_kwf_t:
     case a_kwb_t:
-    case a_vlist_t:
-    case a_plist_t:
-    case a_cmdl_t:
     case a_block_t:
     case a_fsig_t:
     case a_tvar_t:
-    case a_csv_t:
     case a_decl_t:
     case a_vdecl_t:
       // Esses não geram código, mas vamos gerar uma TAC para não deixar uma
       // tac vazia no meio do array, o que adicionaria complexidade
-      ans = tac_cat_tails_arr(tarr, NUM_CHILDREN);
+      ans = tac_cat_arr(tarr, nchild);
       break;
   }
 
   return ans;
 }
 
-struct tac_node *
-tac_get_head(struct tac_node *tail)
+struct tac_prog
+tac_prog_from_frag(struct tac_frag frag)
+{
+  struct tac_prog ans = { NULL, 0, 0, NULL, 0, 0 };
+  struct tac_node *next = NULL;
+
+  // ops[0] é o operando ausente
+  tac_prog_op(&ans, NULL);
+
+  for (struct tac_node *tnode = frag.head; tnode != NULL; tnode = next) {
+    next = tnode->next;
+    tac_prog_push(&ans, tnode->ttype, tac_prog_op(&ans, tnode->ans),
+        tac_prog_op(&ans, tnode->op1), tac_prog_op(&ans, tnode->op2));
+    free(tnode);
+  }
+
+  return ans;
+}
+
+uint32_t
+tac_prog_op(struct tac_prog *prog, struct hash_node *hnode)
 {
-  struct tac_node *ans = tail,
-                  *prev = ans;
+  if ((hnode != NULL) && (hnode->opid != 0))
+    return hnode->opid;
+
+  if ((hnode == NULL) && (prog->nops > 0))
+    return 0;
 
-  while (prev != NULL) {
-    ans = prev;
-    prev = ans->prev;
+  if (prog->nops == prog->opcap) {
+    prog->opcap = prog->opcap ? prog->opcap * 2 : 256;
+    prog->ops = realloc(prog->ops, prog->opcap * sizeof(*prog->ops));
+    if (!prog->ops)
+      REPORT_AND_EXIT;
   }
+  if (prog->nops > UINT32_MAX)
+    LOG_AND_EXIT("Too many operands: %zu\n", prog->nops);
 
+  uint32_t ans = (uint32_t)prog->nops++;
+  prog->ops[ans] = hnode;
+  if (hnode != NULL)
+    hnode->opid = ans;
   return ans;
 }
 
+size_t
+tac_prog_push(struct tac_prog *prog, enum ttype_t ttype, uint32_t ans, uint32_t op1, uint32_t op2)
+{
+  if (prog->ninsns == prog->insncap) {
+    prog->insncap = prog->insncap ? prog->insncap * 2 : 1024;
+    prog->insns = realloc(prog->insns, prog->insncap * sizeof(*prog->insns));
+    if (!prog->insns)
+      REPORT_AND_EXIT;
+  }
+
+  struct tac_insn *insn = &prog->insns[prog->ninsns];
+  insn->ttype = ttype;
+  insn->ans = ans;
+  insn->op1 = op1;
+  insn->op2 = op2;
+  return prog->ninsns++;
+}
+
+uint32_t
+tac_prog_const(struct tac_prog *prog, int32_t val)
+{
+  char key[16];
+  struct hash_typeinfo typeinfo = { hn_int_t, ht_int_t };
+  int len = snprintf(key, sizeof(key), "%d", (int)val);
+  return tac_prog_op(prog, hash_insert(key, (size_t)len, typeinfo));
+}
+
+bool
+tac_prog_const_value(const struct tac_prog *prog, uint32_t id, int32_t *val)
+{
+  struct hash_node *hnode = prog->ops[id];
+  if ((hnode == NULL) || (hnode->typeinfo.nature != hn_int_t))
+    return false;
+
+  // Apenas decimais, como o backend os emite. Negativos só vêm de
+  // tac_prog_const.
+  const char *key = hnode->key;
+  bool neg = (key[0] == '-');
+  size_t len = strlen(key + neg);
+  if ((len == 0) || (len > 10))
+    return false;
+  uint64_t ans = 0;
+  for (size_t i = 0; i < len; i++) {
+    if ((key[neg + i] < '0') || (key[neg + i] > '9'))
+      return false;
+    ans = ans * 10 + (uint64_t)(key[neg + i] - '0');
+  }
+  if (ans > UINT32_MAX)
+    return false;
+  if (neg)
+    ans = -ans;
+  // Como o .long do montador, trunca para 32 bits
+  *val = (int32_t)(uint32_t)ans;
+  return true;
+}
+
+uint32_t
+tac_insn_def(const struct tac_insn *insn)
+{
+  switch (insn->ttype) {
+    case t_vread_t:
+    case t_add_t:
+    case t_sub_t:
+    case t_mul_t:
+    case t_div_t:
+    case t_le_t:
+    case t_ge_t:
+    case t_gt_t:
+    case t_lt_t:
+    case t_eq_t:
+    case t_ne_t:
+    case t_or_t:
+    case t_and_t:
+    case t_pow_t:
+    case t_not_t:
+    case t_copy_t:
+    case t_call_t:
+    case t_read_t:
+      return insn->ans;
+    default:
+      return 0;
+  }
+}
+
+unsigned int
+tac_insn_uses(struct tac_insn *insn, uint32_t *uses[TAC_MAX_USES])
+{
+  unsigned int ans = 0;
+  switch (insn->ttype) {
+    case t_add_t:
+    case t_sub_t:
+    case t_mul_t:
+    case t_div_t:
+    case t_le_t:
+    case t_ge_t:
+    case t_gt_t:
+    case t_lt_t:
+    case t_eq_t:
+    case t_ne_t:
+    case t_or_t:
+    case t_and_t:
+    case t_pow_t:
+    case t_not_t:
+      uses[ans++] = &insn->op1;
+      uses[ans++] = &insn->op2;
+      break;
+    case t_vread_t:
+      // op1 é o vetor
+      uses[ans++] = &insn->op2;
+      break;
+    case t_vcopy_t:
+      // ans é o vetor
+      uses[ans++] = &insn->op1;
+      uses[ans++] = &insn->op2;
+      break;
+    case t_copy_t:
+    case t_jmpf_t:
+      uses[ans++] = &insn->op1;
+      break;
+    case t_arg_t:
+    case t_ret_t:
+    case t_print_t:
+      uses[ans++] = &insn->ans;
+      break;
+    default:
+      break;
+  }
+  return ans;
+}
+
+void
+tac_prog_compact(struct tac_prog *prog)
+{
+  size_t j = 0;
+
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    if (prog->insns[i].ttype != t_nop_t)
+      prog->insns[j++] = prog->insns[i];
+  }
+
+  prog->ninsns = j;
+}
+
+void
+tac_prog_print(const struct tac_prog *prog)
+{
+  for (size_t i = 0; i < prog->ninsns; i++) {
+    const struct tac_insn *insn = &prog->insns[i];
+    tac_print_node(insn->ttype, prog->ops[insn->ans], prog->ops[insn->op1], prog->ops[insn->op2]);
+  }
+}
+
+void
+tac_prog_free(struct tac_prog *prog)
+{
+  for (size_t i = 1; i < prog->nops; i++)
+    prog->ops[i]->opid = 0;
+  free(prog->insns);
+  free(prog->ops);
+  prog->insns = NULL;
+  prog->ops = NULL;
+  prog->ninsns = prog->insncap = 0;
+  prog->nops = prog->opcap = 0;
+}
+
 void
-tac_validate_ops(struct tac_node *tnode, size_t nops, const char *caller, int line)
+tac_validate_ops(const struct tac_insn *insn, size_t nops, const char *caller, int line)
 {
-  if (!tnode)
+  if (!insn)
     LOG_NHEAD_AND_EXIT1(caller, line);
   if (nops >= 1) {
-    if (tnode->ans == NULL)
+    if (insn->ans == 0)
       LOG_NHEAD_AND_EXIT1(caller, line);
     if (nops >= 2) {
-      if (tnode->op1 == NULL)
+      if (insn->op1 == 0)
         LOG_NHEAD_AND_EXIT1(caller, line);
       if (nops == 3) {
-        if (tnode->op2 == NULL)
+        if (insn->op2 == 0)
           LOG_NHEAD_AND_EXIT1(caller, line);
       }
     }
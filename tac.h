@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "hash.h"
 #include "dry.h"
 #include "ast.h"
@@ -39,6 +41,7 @@ enum ttype_t {
   // etc
   t_read_t,
   t_print_t,
+  t_nop_t, // removida, ver tac_prog_compact
   t_unk_t
 };
 
@@ -55,26 +58,43 @@ struct tac_node *
 tac_create(enum ttype_t ttype, DRY(struct hash_node *, ans, op1, op2));
 
 /*
- * Concatena duas listas e retorna a causa. Isto é, se temos:
+ * Fragmento de código: cabeça e cauda de uma lista de TACs, para concatenar
+ * em O(1). O fragmento vazio tem head == tail == NULL. O resultado de uma
+ * expressão é tail->ans.
+ */
+struct tac_frag {
+  struct tac_node *head, *tail;
+};
+
+#define TAC_FRAG_EMPTY { NULL, NULL }
+
+/*
+ * Fragmento de uma TAC só
+ */
+struct tac_frag
+tac_frag(struct tac_node *node);
+
+/*
+ * Concatena dois fragmentos e retorna o resultado. Isto é, se temos:
  *
- * head1 <-> tail1
- * head2 <-> tail2
+ * f1 = head1 <-> tail1
+ * f2 = head2 <-> tail2
  *
  * O resultado será
  *
  * head1 <-> tail1 <-> head2 <-> tail2
- * ans = tail2
+ * ans = { head1, tail2 }
  *
- * Se tail1 é nulo, retorna tail2, e vice-versa.
+ * Se f1 é vazio, retorna f2, e vice-versa.
  *
  */
-struct tac_node *
-tac_cat_tails(DRY(struct tac_node *, tail1, tail2));
+struct tac_frag
+tac_cat(struct tac_frag f1, struct tac_frag f2);
 
 /*
- * Gera código dado a AST, retornando a cabeça da lista gerada
+ * Gera código dado a AST, retornando o fragmento gerado
  */
-struct tac_node *
+struct tac_frag
 tac_gencode(struct ast_node *head);
 
 /*
@@ -90,13 +110,104 @@ void
 tac_printb(struct tac_node *head);
 
 /*
- * Dado a cauda de uma lista, retorna a cabeça
+ * Instrução da representação em array. Operandos são índices em
+ * tac_prog.ops, 0 quando ausentes.
  */
-struct tac_node *
-tac_get_head(struct tac_node *tail);
+struct tac_insn {
+  enum ttype_t ttype;
+  uint32_t ans, op1, op2;
+};
+
+// Máximo de operandos lidos por uma instrução, ver tac_insn_uses
+#define TAC_MAX_USES 2
+
+/*
+ * Programa como um array contíguo de instruções, com os operandos (símbolos,
+ * temporários, labels) numerados numa tabela à parte. É o que as passagens e o
+ * backend percorrem; instruções podem ser removidas (t_nop_t) e reordenadas
+ * por índice.
+ *
+ * ops[0] é NULL, e ops[i]->opid == i. Como o id fica no hash_node, só deve
+ * existir uma tac_prog por vez.
+ */
+struct tac_prog {
+  struct tac_insn *insns;
+  size_t ninsns;
+  size_t insncap;
+  struct hash_node **ops;
+  size_t nops;
+  size_t opcap;
+};
+
+/*
+ * Converte a lista do fragmento para um tac_prog, liberando os nodos da lista
+ */
+struct tac_prog
+tac_prog_from_frag(struct tac_frag frag);
+
+/*
+ * Retorna o id do operando, numerando-o se é a primeira vez que é usado. 0
+ * para NULL.
+ */
+uint32_t
+tac_prog_op(struct tac_prog *prog, struct hash_node *hnode);
+
+/*
+ * Adiciona uma instrução ao final do programa e retorna seu índice
+ */
+size_t
+tac_prog_push(struct tac_prog *prog, enum ttype_t ttype, uint32_t ans, uint32_t op1, uint32_t op2);
+
+/*
+ * Id do operando para a constante inteira val, inserindo o literal na tabela
+ * se necessário
+ */
+uint32_t
+tac_prog_const(struct tac_prog *prog, int32_t val);
+
+/*
+ * Se o operando é uma constante inteira (literal decimal de 32 bits), guarda
+ * o valor em val e retorna true
+ */
+bool
+tac_prog_const_value(const struct tac_prog *prog, uint32_t id, int32_t *val);
+
+/*
+ * Operando escrito pela instrução, 0 se nenhum. t_vcopy_t escreve na memória
+ * do vetor e t_arg_t no parâmetro da função chamada, que não aparecem aqui:
+ * passagens devem tratá-los à parte, assim como t_call_t, que pode escrever
+ * em qualquer variável global.
+ */
+uint32_t
+tac_insn_def(const struct tac_insn *insn);
+
+/*
+ * Guarda em uses ponteiros para os campos da instrução que são lidos, para
+ * que possam ser reescritos, e retorna quantos são
+ */
+unsigned int
+tac_insn_uses(struct tac_insn *insn, uint32_t *uses[TAC_MAX_USES]);
+
+/*
+ * Remove as instruções t_nop_t, mantendo a ordem das demais
+ */
+void
+tac_prog_compact(struct tac_prog *prog);
+
+/*
+ * Imprime o programa, como tac_print
+ */
+void
+tac_prog_print(const struct tac_prog *prog);
+
+/*
+ * Libera as instruções e a tabela de operandos (não os hash_node)
+ */
+void
+tac_prog_free(struct tac_prog *prog);
 
 /*
- * Seja nodo = [ANS, OP1, OP2], aborta se `for OP in min(len(nodo), nops), !OP`
+ * Seja insn = [ANS, OP1, OP2], aborta se `for OP in min(len(insn), nops), !OP`
  */
 void
-tac_validate_ops(struct tac_node *tnode, size_t nops, const char *caller, int line);
+tac_validate_ops(const struct tac_insn *insn, size_t nops, const char *caller, int line);